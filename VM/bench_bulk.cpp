@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+// the kernels are internal to malloc_3, so the benchmark is built as one unit with it
+#include "malloc_3.cpp"
+
+// The streaming zero and copy kernels of malloc_3 against libc memset and memcpy, on
+// 64 KB to 256 MB blocks. After each operation a 512 KB working set the caller just
+// read is read again, HOT_NS shows how much of it the operation evicted.
+// Usage: bench_bulk [max_mb]
+
+#define WORKING_SET (512 * 1024)
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t readWorkingSet(const char* set)
+{
+    const uint64_t* words = (const uint64_t*)set;
+    uint64_t total = 0;
+    for (size_t i = 0; i < WORKING_SET / sizeof(uint64_t); i++)
+    {
+        total += words[i];
+    }
+    return total;
+}
+
+enum Operation { OP_LIBC_ZERO, OP_STREAM_ZERO, OP_LIBC_COPY, OP_STREAM_COPY };
+
+static void runOperation(Operation op, char* dst, const char* src, size_t size)
+{
+    static StreamZeroKernel zero = selectZeroKernel();
+    static StreamCopyKernel copy = selectCopyKernel();
+    switch (op)
+    {
+        case OP_LIBC_ZERO:
+            memset(dst, 0, size);
+            break;
+        case OP_STREAM_ZERO:
+            zero(dst, size);
+            break;
+        case OP_LIBC_COPY:
+            memcpy(dst, src, size);
+            break;
+        case OP_STREAM_COPY:
+            copy(dst, src, size);
+            break;
+    }
+}
+
+// GB/s of the operation and the median ns to read the working set after it
+static void measure(Operation op, char* dst, const char* src, size_t size, const char* set, double* gbps,
+                    double* hot_ns)
+{
+    int repeats = (int)(256 * 1024 * 1024 / size);
+    repeats = repeats < 3 ? 3 : (repeats > 200 ? 200 : repeats);
+    uint64_t op_ns = 0;
+    uint64_t set_ns[200];
+    uint64_t checksum = 0;
+    runOperation(op, dst, src, size); // faults the pages in
+    for (int i = 0; i < repeats; i++)
+    {
+        checksum += readWorkingSet(set);
+        uint64_t start = nowNs();
+        runOperation(op, dst, src, size);
+        uint64_t middle = nowNs();
+        checksum += readWorkingSet(set);
+        set_ns[i] = nowNs() - middle;
+        op_ns += middle - start;
+    }
+    *gbps = (double)size * repeats / op_ns;
+    std::sort(set_ns, set_ns + repeats);
+    *hot_ns = (double)set_ns[repeats / 2] + (checksum == 1 ? 1 : 0);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t max_size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) * 1024 * 1024;
+    char* dst = (char*)aligned_alloc(64, max_size);
+    char* src = (char*)aligned_alloc(64, max_size);
+    char* set = (char*)aligned_alloc(64, WORKING_SET);
+    if (dst == NULL || src == NULL || set == NULL)
+    {
+        fprintf(stderr, "bench_bulk: out of memory\n");
+        return 1;
+    }
+    memset(src, 'b', max_size);
+    memset(set, 'w', WORKING_SET);
+    printf("%10s %10s %10s %12s %12s %10s %10s %12s %12s\n", "SIZE_KB", "MEMSET", "ZERO_NT", "HOT_NS_LIBC",
+           "HOT_NS_NT", "MEMCPY", "COPY_NT", "HOT_NS_LIBC", "HOT_NS_NT");
+    for (size_t size = 64 * 1024; size <= max_size; size *= 4)
+    {
+        double gbps[4];
+        double hot_ns[4];
+        for (int op = OP_LIBC_ZERO; op <= OP_STREAM_COPY; op++)
+        {
+            measure((Operation)op, dst, src, size, set, &gbps[op], &hot_ns[op]);
+        }
+        printf("%10zu %8.1fGB %8.1fGB %12.0f %12.0f %8.1fGB %8.1fGB %12.0f %12.0f\n", size / 1024,
+               gbps[OP_LIBC_ZERO], gbps[OP_STREAM_ZERO], hot_ns[OP_LIBC_ZERO], hot_ns[OP_STREAM_ZERO],
+               gbps[OP_LIBC_COPY], gbps[OP_STREAM_COPY], hot_ns[OP_LIBC_COPY], hot_ns[OP_STREAM_COPY]);
+    }
+    free(dst);
+    free(src);
+    free(set);
+    return 0;
+}
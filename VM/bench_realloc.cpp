@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "malloc_3.h"
+
+// Realloc-heavy growth, srealloc against libc realloc: a string appended to a few
+// bytes at a time, a vector doubling its capacity, and 64 KB buffers shrunk to 200
+// bytes. MOVED counts the calls that returned a new address.
+// Usage: bench_realloc [rounds]
+
+typedef void* (*ReallocFunction)(void*, size_t);
+typedef void (*FreeFunction)(void*);
+
+typedef struct Allocator {
+    const char* name;
+    ReallocFunction reallocate;
+    FreeFunction release;
+} Allocator;
+
+typedef struct Result {
+    uint64_t ns;
+    size_t calls;
+    size_t moved;
+} Result;
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static char* grow(const Allocator& allocator, char* buffer, size_t size, Result* result)
+{
+    char* grown = (char*)allocator.reallocate(buffer, size);
+    if (grown == NULL)
+    {
+        fprintf(stderr, "bench_realloc: %s failed at %zu bytes\n", allocator.name, size);
+        exit(1);
+    }
+    result->calls++;
+    result->moved += (buffer != NULL && grown != buffer) ? 1 : 0;
+    return grown;
+}
+
+// appends 1 to 32 bytes per call up to 64 KB, like a string without spare capacity
+static void appendString(const Allocator& allocator, int rounds, Result* result)
+{
+    for (int round = 0; round < rounds; round++)
+    {
+        char* text = NULL;
+        size_t length = 0;
+        for (size_t step = 1; length < 64 * 1024; step = step % 32 + 1)
+        {
+            text = grow(allocator, text, length + step, result);
+            memset(text + length, 'x', step);
+            length += step;
+        }
+        allocator.release(text);
+    }
+}
+
+// doubles the capacity from 16 bytes up to 8 MB, writing each new half
+static void doubleVector(const Allocator& allocator, int rounds, Result* result)
+{
+    for (int round = 0; round < rounds; round++)
+    {
+        char* items = NULL;
+        size_t used = 0;
+        for (size_t capacity = 16; capacity <= 8 * 1024 * 1024; capacity *= 2)
+        {
+            items = grow(allocator, items, capacity, result);
+            memset(items + used, 'v', capacity - used);
+            used = capacity;
+        }
+        allocator.release(items);
+    }
+}
+
+// shrinks many 64 KB buffers to 200 bytes, then grows them back
+static void shrinkAndRegrow(const Allocator& allocator, int rounds, Result* result)
+{
+    const int buffers_num = 16;
+    char* buffers[buffers_num];
+    for (int round = 0; round < rounds; round++)
+    {
+        for (int i = 0; i < buffers_num; i++)
+        {
+            buffers[i] = grow(allocator, NULL, 64 * 1024, result);
+            memset(buffers[i], 's', 200);
+        }
+        for (int i = 0; i < buffers_num; i++)
+        {
+            buffers[i] = grow(allocator, buffers[i], 200, result);
+        }
+        for (int i = 0; i < buffers_num; i++)
+        {
+            buffers[i] = grow(allocator, buffers[i], 64 * 1024, result);
+            allocator.release(buffers[i]);
+        }
+    }
+}
+
+static void report(const char* workload, const Allocator& allocator, void (*run)(const Allocator&, int, Result*),
+                   int rounds)
+{
+    Result result = {0, 0, 0};
+    uint64_t start = nowNs();
+    run(allocator, rounds, &result);
+    result.ns = nowNs() - start;
+    printf("%-8s %-8s %10zu %10zu %10.1f\n", workload, allocator.name, result.calls, result.moved,
+           (double)result.ns / result.calls);
+}
+
+int main(int argc, char* argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    Allocator allocators[] = {{"srealloc", srealloc, sfree}, {"realloc", realloc, free}};
+    printf("%-8s %-8s %10s %10s %10s\n", "WORKLOAD", "ALLOC", "CALLS", "MOVED", "NS/CALL");
+    for (const Allocator& allocator : allocators)
+    {
+        report("string", allocator, appendString, rounds);
+        report("vector", allocator, doubleVector, rounds);
+        report("shrink", allocator, shrinkAndRegrow, rounds);
+    }
+    // what the shrinks gave back to the heap
+    size_t free_before = _num_free_bytes();
+    char* buffer = (char*)smalloc(64 * 1024);
+    size_t free_taken = _num_free_bytes();
+    buffer = (char*)srealloc(buffer, 200);
+    printf("64 KB shrunk to 200 bytes: %zu of %zu bytes back on the free lists\n",
+           _num_free_bytes() - free_taken, free_before - free_taken);
+    sfree(buffer);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "malloc_3.h"
+
+// Producer/consumer ping-pong over the default heap. The main thread owns the heap
+// and allocates messages, a second thread consumes them. With "remote" the consumer
+// frees them itself (lock or remote-free queue), with "owner" it hands every message
+// back so the owner frees it. Usage: bench_remote_free [messages] [message_size]
+
+#define RING_SIZE 1024
+
+typedef struct Ring {
+    void* slots[RING_SIZE];
+    size_t head; // next slot to write, only the producer moves it
+    size_t tail; // next slot to read, only the consumer moves it
+} Ring;
+
+static void ringPush(Ring* ring, void* p)
+{
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+    {
+        sched_yield(); // also fair on a single CPU
+    }
+    ring->slots[head % RING_SIZE] = p;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// NULL when the ring is empty
+static void* ringTryPop(Ring* ring)
+{
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    void* p = ring->slots[tail % RING_SIZE];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+typedef struct PingPong {
+    Ring to_consumer;
+    Ring to_owner;
+    size_t messages;
+    bool remote;
+} PingPong;
+
+static void* consume(void* arg)
+{
+    PingPong* pp = (PingPong*)arg;
+    for (size_t i = 0; i < pp->messages;)
+    {
+        char* message = (char*)ringTryPop(&pp->to_consumer);
+        if (message == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+        message[0]++;
+        if (pp->remote)
+        {
+            sfree(message);
+        }
+        else
+        {
+            ringPush(&pp->to_owner, message);
+        }
+        i++;
+    }
+    return NULL;
+}
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run(size_t messages, size_t message_size, bool remote)
+{
+    PingPong* pp = (PingPong*)calloc(1, sizeof(PingPong));
+    pp->messages = messages;
+    pp->remote = remote;
+    pthread_t consumer;
+    uint64_t start = nowNs();
+    pthread_create(&consumer, NULL, consume, pp);
+    size_t returned = 0;
+    for (size_t i = 0; i < messages; i++)
+    {
+        char* message = (char*)smalloc(message_size);
+        if (message == NULL)
+        {
+            fprintf(stderr, "bench_remote_free: smalloc failed\n");
+            exit(1);
+        }
+        memset(message, 0, message_size < 64 ? message_size : 64);
+        ringPush(&pp->to_consumer, message);
+        for (void* back = ringTryPop(&pp->to_owner); back != NULL; back = ringTryPop(&pp->to_owner))
+        {
+            sfree(back);
+            returned++;
+        }
+    }
+    while (!remote && returned < messages)
+    {
+        void* back = ringTryPop(&pp->to_owner);
+        if (back == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+        sfree(back);
+        returned++;
+    }
+    pthread_join(consumer, NULL);
+    uint64_t elapsed = nowNs() - start;
+    // the next owner allocation drains whatever is still queued
+    sfree(smalloc(1));
+    printf("%-7s %10zu %8zu %10.1f %12zu %10zu\n", remote ? "remote" : "owner", messages, message_size,
+           (double)elapsed / messages, _num_allocated_blocks() - _num_free_blocks(), _num_free_blocks());
+    free(pp);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+    size_t message_size = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+    sfree(smalloc(1)); // the main thread becomes the owner
+    printf("%-7s %10s %8s %10s %12s %10s\n", "FREE_BY", "MESSAGES", "SIZE", "NS/MSG", "USED_BLOCKS", "FREE_BLK");
+    for (int round = 0; round < 2; round++)
+    {
+        run(messages, message_size, false);
+        run(messages, message_size, true);
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "malloc_3.h"
+
+// Hands payloads of 1 to 64 MB from a forked child to its parent, once copied
+// through a pipe and once as an offset into the shared heap. The child fills each
+// payload, the parent sums it, so both sides touch every byte in both modes.
+// Usage: bench_shared_heap [rounds]
+
+#define MAX_PAYLOAD (64 * 1024 * 1024)
+#define IN_FLIGHT 2 // shared payloads the child may have handed over and not seen freed
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fill(char* payload, size_t size, int round)
+{
+    memset(payload, 'a' + round % 26, size);
+}
+
+static uint64_t sum(const char* payload, size_t size)
+{
+    const uint64_t* words = (const uint64_t*)payload;
+    uint64_t total = 0;
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+    {
+        total += words[i];
+    }
+    return total;
+}
+
+static bool readAll(int fd, void* buffer, size_t size)
+{
+    for (size_t done = 0; done < size;)
+    {
+        ssize_t bytes_num = read(fd, (char*)buffer + done, size - done);
+        if (bytes_num <= 0)
+        {
+            return false;
+        }
+        done += bytes_num;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* buffer, size_t size)
+{
+    for (size_t done = 0; done < size;)
+    {
+        ssize_t bytes_num = write(fd, (const char*)buffer + done, size - done);
+        if (bytes_num <= 0)
+        {
+            return false;
+        }
+        done += bytes_num;
+    }
+    return true;
+}
+
+// returns the parent's ns per payload, from the first byte asked for to the last one summed
+static double run(size_t size, int rounds, bool shared)
+{
+    int data[2];
+    int acks[2]; // a byte per freed shared payload
+    if (pipe(data) == -1 || pipe(acks) == -1)
+    {
+        perror("bench_shared_heap: pipe failed");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(data[0]);
+        close(acks[1]);
+        char* buffer = shared ? NULL : (char*)malloc(size);
+        for (int round = 0; round < rounds; round++)
+        {
+            if (shared)
+            {
+                // only the offset crosses the pipe, the parent frees the block
+                char ack;
+                if (round >= IN_FLIGHT && !readAll(acks[0], &ack, 1))
+                {
+                    _exit(1);
+                }
+                char* payload = (char*)sshared_malloc(size);
+                if (payload == NULL)
+                {
+                    _exit(1);
+                }
+                fill(payload, size, round);
+                size_t offset = sshared_offset(payload);
+                writeAll(data[1], &offset, sizeof(offset));
+            }
+            else
+            {
+                fill(buffer, size, round);
+                writeAll(data[1], buffer, size);
+            }
+        }
+        _exit(0);
+    }
+    close(data[1]);
+    close(acks[0]);
+    char* buffer = shared ? NULL : (char*)malloc(size);
+    uint64_t checksum = 0;
+    uint64_t start = nowNs();
+    for (int round = 0; round < rounds; round++)
+    {
+        if (shared)
+        {
+            size_t offset;
+            if (!readAll(data[0], &offset, sizeof(offset)))
+            {
+                fprintf(stderr, "bench_shared_heap: the child failed\n");
+                exit(1);
+            }
+            char* payload = (char*)sshared_ptr(offset);
+            checksum += sum(payload, size);
+            sshared_free(payload);
+            if (round + IN_FLIGHT < rounds)
+            {
+                writeAll(acks[1], "", 1); // only the acks the child waits for
+            }
+        }
+        else
+        {
+            readAll(data[0], buffer, size);
+            checksum += sum(buffer, size);
+        }
+    }
+    uint64_t elapsed = nowNs() - start;
+    close(data[0]);
+    close(acks[1]);
+    waitpid(pid, NULL, 0);
+    free(buffer);
+    if (checksum == 0)
+    {
+        fprintf(stderr, "bench_shared_heap: empty payloads\n");
+    }
+    return (double)elapsed / rounds;
+}
+
+int main(int argc, char* argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    // room for the payloads of a few rounds in flight
+    if (sshared_init(4 * MAX_PAYLOAD) == NULL)
+    {
+        perror("bench_shared_heap: sshared_init failed");
+        return 1;
+    }
+    printf("%8s %14s %14s %9s\n", "SIZE_MB", "PIPE_MB/S", "SHARED_MB/S", "SPEEDUP");
+    for (size_t size = 1024 * 1024; size <= MAX_PAYLOAD; size *= 2)
+    {
+        double pipe_ns = run(size, rounds, false);
+        double shared_ns = run(size, rounds, true);
+        double mb = (double)size / (1024 * 1024);
+        printf("%8.0f %14.1f %14.1f %8.2fx\n", mb, mb * 1e9 / pipe_ns, mb * 1e9 / shared_ns, pipe_ns / shared_ns);
+    }
+    return 0;
+}
@@ -1,5 +1,51 @@
 #include <unistd.h>
 #include <cmath>
+#include <stdint.h>
+
+#define CHUNK_SIZE (128 * 1024) // 128 KB, chunks are sized in multiples of it
+#define SLICE_ALIGNMENT 16
+
+// [chunk_top, chunk_end) is the unused part of the current chunk
+static char* chunk_top = NULL;
+static char* chunk_end = NULL;
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// make room for at least size bytes, extending the current chunk when it still ends at the break
+static bool growChunk(size_t size)
+{
+    char* current_break = (char*)sbrk(0);
+    if (current_break == (char*)-1)
+    {
+        return false;
+    }
+    char* start = chunk_top;
+    if (current_break != chunk_end) // someone else moved the break, start a new chunk
+    {
+        start = (char*)alignUp((uintptr_t)current_break, SLICE_ALIGNMENT);
+    }
+    char* end = start + alignUp(size, CHUNK_SIZE);
+    if (sbrk(end - current_break) == (void*)-1)
+    {
+        return false;
+    }
+    chunk_top = start;
+    chunk_end = end;
+    return true;
+}
+
+// pre-size the current chunk so the next allocations of up to bytes in total never call sbrk
+bool sreserve(size_t bytes)
+{
+    if ((size_t)(chunk_end - chunk_top) >= bytes)
+    {
+        return true;
+    }
+    return growChunk(bytes);
+}
 
 void* smalloc(size_t size)
 {
@@ -7,6 +53,12 @@ void* smalloc(size_t size)
     {
         return NULL;
     }
-    void* first_allocated_byte = sbrk(size);
-    return (first_allocated_byte == (void*)-1) ? NULL : first_allocated_byte;
-}
\ No newline at end of file
+    size_t slice_size = alignUp(size, SLICE_ALIGNMENT);
+    if ((size_t)(chunk_end - chunk_top) < slice_size && !growChunk(slice_size))
+    {
+        return NULL;
+    }
+    void* first_allocated_byte = chunk_top;
+    chunk_top += slice_size;
+    return first_allocated_byte;
+}
@@ -4,423 +4,2415 @@
 #include <sys/mman.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <new>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "malloc_3.h"
+#include "malloc_stats.h"
 
 #define MAX_ORDER 10
 #define MAX_BLOCK_SIZE (128 * 1024) // 128 KB
 #define PAGE_SIZE 4096 // 4KB
 #define ALIGNMENT (32 * 128 * 1024) // 4MB
+#define DEFAULT_MMAP_THRESHOLD_MAX (32 * 1024 * 1024) // 32MB
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024) // 2MB
+#define STREAMING_THRESHOLD (1024 * 1024) // 1MB, bigger copies and fills bypass the caches
 
 
 typedef struct MallocMetadata {
     size_t size;
     bool is_free;
+    bool is_mmap;
+    bool is_growable; // an mmapped block inside a reservation, see Growable,Buffers
+    uint8_t tag; // accounting tag from smalloc_tagged, 0 for untagged blocks
+    uint32_t handle; // index in the handle table, 0 for plain allocations
     MallocMetadata* next;
     MallocMetadata* prev;
 } MallocMetadata;
 
-class FreeList {
-    MallocMetadata* free_lists[MAX_ORDER + 1];
-    size_t total_blocks;
-    size_t total_allocated_bytes;
-    bool initialized;
-    FreeList() : free_lists{NULL}, total_blocks(0), total_allocated_bytes(0), initialized(false) {}
+////////////////////////////////////Latency,Histograms//////////////////////////////////
+
+// Log-linear buckets: 4 linear steps per power of two, from 1 ns up to ~1 s
+#define HISTOGRAM_SUB_BUCKETS 4
+#define HISTOGRAM_BUCKETS (30 * HISTOGRAM_SUB_BUCKETS)
+
+// Opt-in, while disabled every operation pays a single branch. The buckets are counted
+// atomically and the path of an operation comes from its heap (see FreeList::notePath).
+class Histograms {
+    uint64_t buckets[OPS_NUM][PATHS_NUM][HISTOGRAM_BUCKETS];
+    bool enabled;
+    double cycles_per_ns;
+    Histograms() : buckets{}, enabled(false), cycles_per_ns(1) {}
+    static uint64_t now();
+    static uint64_t monotonicNs();
 public:
-    static FreeList& getInstance() // make FreeList
+    static Histograms& getInstance() // make Histograms
     {
-        static FreeList instance; // Guaranteed to be destroyed.
+        static Histograms instance; // Guaranteed to be destroyed.
         // Instantiated on first use.
         return instance;
     }
-    MallocMetadata* getFreeList(int i);
-    size_t getToatalBlocks();
-    void increaseToatalBlocks();
-    void decreaseToatalBlocks();
-    size_t getToatalAllocatedBytes();
-    void addToatalAllocatedBytes(size_t add);
-    bool isInitialized();
-    void* initializeFreeLists();
-    void* allocateBlock(int order);
-    void insertBlock(MallocMetadata* block, int order);
-    void removeBlock(MallocMetadata* block, int order);
+    static int bucketOf(uint64_t ns);
+    static uint64_t bucketLimit(int bucket);
+    void enable(bool enable);
+    void reset();
+    uint64_t start();
+    void record(AllocOperation op, AllocPath path, uint64_t start);
+    uint64_t getCount(AllocOperation op, AllocPath path, int bucket);
+    uint64_t getPercentile(AllocOperation op, AllocPath path, double percentile);
+    void print();
 };
 
-MallocMetadata* FreeList::getFreeList(int i)
+uint64_t Histograms::monotonicNs()
 {
-    return this->free_lists[i];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
+uint64_t Histograms::now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonicNs();
+#endif
+}
 
-size_t FreeList::getToatalBlocks()
+int Histograms::bucketOf(uint64_t ns)
 {
-    return this->total_blocks;
+    if (ns < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (int)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int bucket = (msb - 1) * HISTOGRAM_SUB_BUCKETS + (int)((ns >> (msb - 2)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
 }
 
-void FreeList::increaseToatalBlocks()
+// largest latency (in ns) that still falls into bucket
+uint64_t Histograms::bucketLimit(int bucket)
 {
-    this->total_blocks++;
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    int msb = bucket / HISTOGRAM_SUB_BUCKETS + 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << (msb - 2)) - 1;
 }
 
-void FreeList::decreaseToatalBlocks()
+void Histograms::enable(bool enable)
 {
-    this->total_blocks--;
+#if defined(__x86_64__) || defined(__i386__)
+    if (enable && !enabled)
+    {
+        // calibrate the cycle counter against the monotonic clock for 1ms
+        uint64_t ns_start = monotonicNs();
+        uint64_t cycles_start = now();
+        while (monotonicNs() - ns_start < 1000000) {}
+        cycles_per_ns = (double)(now() - cycles_start) / (monotonicNs() - ns_start);
+    }
+#endif
+    enabled = enable;
 }
 
-size_t FreeList::getToatalAllocatedBytes()
+void Histograms::reset()
 {
-    return this->total_allocated_bytes;
+    memset(buckets, 0, sizeof(buckets));
 }
 
-void FreeList::addToatalAllocatedBytes(size_t add)
+uint64_t Histograms::start()
 {
-    this->total_allocated_bytes += add;
+    return enabled ? now() : 0;
 }
 
-bool FreeList::isInitialized()
+void Histograms::record(AllocOperation op, AllocPath path, uint64_t start)
 {
-    return this->initialized;
+    if (!enabled || start == 0)
+    {
+        return;
+    }
+    uint64_t ns = (uint64_t)((now() - start) / cycles_per_ns);
+    __atomic_fetch_add(&buckets[op][path][bucketOf(ns)], 1, __ATOMIC_RELAXED);
 }
 
-void* FreeList::initializeFreeLists() 
+uint64_t Histograms::getCount(AllocOperation op, AllocPath path, int bucket)
 {
-    void* base = sbrk(0);
-    if (base == (void*)-1) 
+    return __atomic_load_n(&buckets[op][path][bucket], __ATOMIC_RELAXED);
+}
+
+uint64_t Histograms::getPercentile(AllocOperation op, AllocPath path, double percentile)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
     {
-        return NULL;
+        total += getCount(op, path, i);
     }
-    uintptr_t base_addr = (uintptr_t)base;
-    uintptr_t aligned_brk_addr = (base_addr+ ALIGNMENT - 1) & ~(ALIGNMENT - 1);
-    size_t offset = aligned_brk_addr - base_addr;
-    if (sbrk(offset + ALIGNMENT) == (void*)-1) 
+    if (total == 0)
     {
-        return NULL;
+        return 0;
     }
-    MallocMetadata* block = (MallocMetadata*)aligned_brk_addr;
-    free_lists[MAX_ORDER] = block;
-    for (int i = 0; i < 32; i++) 
+    uint64_t rank = (uint64_t)ceil(total * percentile);
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
     {
-        block->size = MAX_BLOCK_SIZE;
-        block->is_free = true;
-        if (i < 31) 
-        {
-            block->next = (MallocMetadata*)((char*)block + MAX_BLOCK_SIZE);
-        }
-        if (i > 0) 
+        seen += getCount(op, path, i);
+        if (seen >= rank)
         {
-            block->prev = (MallocMetadata*)((char*)block - MAX_BLOCK_SIZE);
+            return bucketLimit(i);
         }
-        block = block->next;
-    }
-    for (int i = 0; i < MAX_ORDER; i++)
-    {
-        free_lists[i] = NULL;
     }
-    total_blocks = 32;
-    total_allocated_bytes = 32 * (MAX_BLOCK_SIZE-sizeof(MallocMetadata));
-    initialized = true;
-    return base;
+    return bucketLimit(HISTOGRAM_BUCKETS - 1);
 }
 
-void* FreeList::allocateBlock(int order)
+void Histograms::print()
 {
-    for (int i = order; i <= MAX_ORDER; i++) 
+    const char* op_names[OPS_NUM] = {"smalloc", "scalloc", "sfree", "srealloc"};
+    const char* path_names[PATHS_NUM] = {"buddy", "mmap", "split", "merge"};
+    for (int op = 0; op < OPS_NUM; op++)
     {
-        MallocMetadata* block = free_lists[i];
-        if (block) 
+        for (int path = 0; path < PATHS_NUM; path++)
         {
-            removeBlock(block,i);
-            // Split
-            while (i > order) 
+            uint64_t count = 0;
+            for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
             {
-                total_blocks++;
-                MallocMetadata* buddy = (MallocMetadata*)((size_t)(block) ^ (block->size/2));
-                buddy->size = block->size / 2;
-                buddy->is_free = true;
-                buddy->next = NULL;
-                buddy->prev = NULL;
-                insertBlock(buddy,i-1);
-                block->size /= 2;
-                total_allocated_bytes -= sizeof(MallocMetadata);
-                i--;
+                count += getCount((AllocOperation)op, (AllocPath)path, i);
             }
-            block->is_free = false;
-            return (char*)(block) + sizeof(MallocMetadata);
+            if (count == 0)
+            {
+                continue;
+            }
+            printf("%-8s %-5s count=%llu p50=%lluns p99=%lluns p999=%lluns\n", op_names[op], path_names[path],
+                   (unsigned long long)count,
+                   (unsigned long long)getPercentile((AllocOperation)op, (AllocPath)path, 0.5),
+                   (unsigned long long)getPercentile((AllocOperation)op, (AllocPath)path, 0.99),
+                   (unsigned long long)getPercentile((AllocOperation)op, (AllocPath)path, 0.999));
         }
     }
-    return NULL;
 }
 
-void FreeList::insertBlock(MallocMetadata* block, int order) 
+////////////////////////////////////Page,Helpers//////////////////////////////////
+
+// fault in every page of [start, start + length) without changing its content
+static void prefaultRange(void* start, size_t length)
 {
-    if (free_lists[order] == NULL) 
+#ifdef MADV_POPULATE_WRITE
+    uintptr_t first_page = (uintptr_t)start & ~(uintptr_t)(PAGE_SIZE - 1);
+    uintptr_t end = (uintptr_t)start + length;
+    if (madvise((void*)first_page, end - first_page, MADV_POPULATE_WRITE) == 0)
     {
-        free_lists[order] = block;
-        block->prev = NULL;
-        block->next = NULL;
-    } 
-    else 
+        return;
+    }
+#endif
+    // older kernels: touch one byte per page
+    for (char* page = (char*)start; page < (char*)start + length;
+         page = (char*)(((uintptr_t)page + PAGE_SIZE) & ~(uintptr_t)(PAGE_SIZE - 1)))
     {
-        MallocMetadata* current = free_lists[order];
-        while (current && (char*)current < (char*)block) 
-        {
-            current = current->next;
-        }
-        if (current) 
-        {
-            block->next = current;
-            block->prev = current->prev;
-            if (current->prev) 
-            {
-                current->prev->next = block;
-            } 
-            else 
-            {
-                free_lists[order] = block;
-            }
-            current->prev = block;
-        } 
-        else 
-        {
-            MallocMetadata* tail = free_lists[order];
-            while (tail->next)
-            {
-                tail = tail->next;
-            }
-            tail->next = block;
-            block->prev = tail;
-            block->next = NULL;
-        }
+        *(volatile char*)page = *(volatile char*)page;
     }
 }
 
-void FreeList::removeBlock(MallocMetadata* block, int order)
+// Anonymous mapping for an mmapped block. With SMALLOC_HUGEPAGE it starts on a
+// 2MB boundary, the length stays a multiple of PAGE_SIZE so sfree unmaps all of it.
+static void* mapBlock(size_t mmap_size, unsigned int flags)
 {
-    if (block->prev) 
+    if (!(flags & SMALLOC_HUGEPAGE))
     {
-        block->prev->next = block->next;
-    } 
-    else 
+        int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (flags & SMALLOC_PREFAULT)
+        {
+            map_flags |= MAP_POPULATE;
+        }
+        return mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+    }
+    size_t reserved_size = mmap_size + HUGE_PAGE_SIZE;
+    char* reserved = (char*)mmap(NULL, reserved_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED)
     {
-        free_lists[order] = block->next;
+        return MAP_FAILED;
     }
-    if (block->next) 
+    char* aligned = (char*)(((uintptr_t)reserved + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > reserved)
     {
-        block->next->prev = block->prev;
+        munmap(reserved, aligned - reserved);
+    }
+    munmap(aligned + mmap_size, reserved + reserved_size - (aligned + mmap_size));
+    madvise(aligned, mmap_size, MADV_HUGEPAGE);
+    if (flags & SMALLOC_PREFAULT)
+    {
+        prefaultRange(aligned, mmap_size);
     }
+    return aligned;
 }
 
-////////////////////////////////////5-10,Functions//////////////////////////////////
+////////////////////////////////////Bulk,Kernels//////////////////////////////////
 
-size_t _num_free_blocks()
+// Zeroing and copying for big payloads. Above STREAMING_THRESHOLD they use
+// non-temporal stores, so a 100MB scalloc or srealloc doesn't evict the caller's
+// working set. The AVX2/SSE2 variant is picked once at runtime.
+
+typedef void (*StreamZeroKernel)(char* dst, size_t n);
+typedef void (*StreamCopyKernel)(char* dst, const char* src, size_t n);
+
+#if defined(__x86_64__) || defined(__i386__)
+// dst is 32 byte aligned and n a multiple of 32 in all kernels
+__attribute__((target("avx2"))) static void streamZeroAvx2(char* dst, size_t n)
 {
-    size_t count = 0;
-    for (int i = 0; i <= MAX_ORDER; i++) 
+    __m256i zero = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 32)
     {
-        MallocMetadata* block = FreeList::getInstance().getFreeList(i);
-        while (block) 
-        {
-            count++;
-            block = block->next;
-        }
+        _mm256_stream_si256((__m256i*)(dst + i), zero);
     }
-    return count;
+    _mm_sfence();
 }
 
-size_t _num_free_bytes() 
+__attribute__((target("avx2"))) static void streamCopyAvx2(char* dst, const char* src, size_t n)
 {
-    size_t count = 0;
-    for (int i = 0; i <= MAX_ORDER; i++) 
+    for (size_t i = 0; i < n; i += 32)
     {
-        MallocMetadata* block = FreeList::getInstance().getFreeList(i);
-        while (block) 
-        {
-            count += (block->size - sizeof(MallocMetadata));
-            block = block->next;
-        }
+        _mm256_stream_si256((__m256i*)(dst + i), _mm256_loadu_si256((const __m256i*)(src + i)));
     }
-    return count;
+    _mm_sfence();
 }
 
-size_t _num_allocated_blocks() 
+__attribute__((target("sse2"))) static void streamZeroSse2(char* dst, size_t n)
 {
-    return FreeList::getInstance().getToatalBlocks();
+    __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 16)
+    {
+        _mm_stream_si128((__m128i*)(dst + i), zero);
+    }
+    _mm_sfence();
 }
 
-size_t _num_allocated_bytes() 
+__attribute__((target("sse2"))) static void streamCopySse2(char* dst, const char* src, size_t n)
 {
-    return FreeList::getInstance().getToatalAllocatedBytes();
+    for (size_t i = 0; i < n; i += 16)
+    {
+        _mm_stream_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+    }
+    _mm_sfence();
 }
+#endif
 
-size_t _num_meta_data_bytes() 
+static void streamZeroScalar(char* dst, size_t n)
 {
-    return FreeList::getInstance().getToatalBlocks() * sizeof(MallocMetadata);
+    memset(dst, 0, n);
 }
 
-size_t _size_meta_data() 
+static void streamCopyScalar(char* dst, const char* src, size_t n)
 {
-    return sizeof(MallocMetadata);
+    memcpy(dst, src, n);
 }
 
-////////////////////////////////////1-4,Functions//////////////////////////////////
-
-void* smalloc(size_t size) 
+static StreamZeroKernel selectZeroKernel()
 {
-    if (!FreeList::getInstance().isInitialized()) 
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
     {
-        if (!FreeList::getInstance().initializeFreeLists())
-        {
-            return NULL;
-        }
+        return streamZeroAvx2;
     }
-    if ((size == 0) || (size > pow(10, 8))) 
+    if (__builtin_cpu_supports("sse2"))
     {
-        return NULL;
+        return streamZeroSse2;
     }
-    int order = ceil(log2(size + sizeof(MallocMetadata))) - 7;
-    if (order < 0)
+#endif
+    return streamZeroScalar;
+}
+
+static StreamCopyKernel selectCopyKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
     {
-        order = 0;
+        return streamCopyAvx2;
     }
-    if (size + sizeof(MallocMetadata) > MAX_BLOCK_SIZE)
+    if (__builtin_cpu_supports("sse2"))
     {
-        size_t mmap_size = ((size + sizeof(MallocMetadata) + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
-        void* ptr = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (ptr == (void *) -1) 
-        {
-            return NULL;
-        }
-        MallocMetadata* block = (MallocMetadata*)(ptr);
-        block->size = size + sizeof(MallocMetadata);
-        block->is_free = false;
-        FreeList::getInstance().increaseToatalBlocks();
-        FreeList::getInstance().addToatalAllocatedBytes(size);
-        return (char*)(block) + sizeof(MallocMetadata);
+        return streamCopySse2;
     }
-    return FreeList::getInstance().allocateBlock(order);
+#endif
+    return streamCopyScalar;
 }
 
-void* scalloc(size_t num, size_t size)
+// streaming is forced for buffers the caller marked with SMALLOC_NOCACHE_HINT
+static void bulkZero(void* dst, size_t n, bool streaming)
 {
-    void* allocated = smalloc (num * size);
-    if (allocated == NULL)
+    static StreamZeroKernel kernel = selectZeroKernel();
+    if (!streaming && n < STREAMING_THRESHOLD)
     {
-        return NULL;
+        memset(dst, 0, n);
+        return;
+    }
+    char* start = (char*)dst;
+    char* aligned = (char*)(((uintptr_t)start + 31) & ~(uintptr_t)31);
+    if (aligned > start + n)
+    {
+        aligned = start + n;
     }
-    return memset(allocated, 0, num * size);
+    size_t body = (start + n - aligned) & ~(size_t)31;
+    memset(start, 0, aligned - start);
+    kernel(aligned, body);
+    memset(aligned + body, 0, start + n - (aligned + body));
 }
 
-void sfree(void* p)
+// memmove semantics, a forward copy is only safe when dst doesn't start inside src
+static void bulkCopy(void* dst, const void* src, size_t n)
 {
-    if (p == NULL)
+    static StreamCopyKernel kernel = selectCopyKernel();
+    char* to = (char*)dst;
+    const char* from = (const char*)src;
+    if (n < STREAMING_THRESHOLD || (to > from && to < from + n))
     {
+        memmove(dst, src, n);
         return;
     }
-    MallocMetadata* block = (MallocMetadata*)((char*)(p) - sizeof(MallocMetadata));
-    if (block->size > MAX_BLOCK_SIZE)
+    size_t head = (32 - ((uintptr_t)to & 31)) & 31;
+    memmove(to, from, head);
+    size_t body = (n - head) & ~(size_t)31;
+    kernel(to + head, from + head, body);
+    memmove(to + head + body, from + head + body, n - head - body);
+}
+
+////////////////////////////////////Allocation,Tags//////////////////////////////////
+
+// Per-tag accounting for smalloc_tagged. The tag lives in the block metadata, so
+// freeing finds its counters without a lookup. Every heap has its own table inside
+// its FreeList, guarded by the heap lock like the lists.
+class TagTable {
+    SmallocTagStats tags[SMALLOC_MAX_TAGS];
+public:
+    TagTable() : tags{} {}
+    void add(MallocMetadata* block, uint8_t tag, bool new_allocation);
+    void remove(MallocMetadata* block);
+    const SmallocTagStats& get(uint8_t tag);
+    void print();
+};
+
+// accounts the whole payload of the block, which is what sfree gives back
+void TagTable::add(MallocMetadata* block, uint8_t tag, bool new_allocation)
+{
+    block->tag = tag;
+    tags[tag].live_bytes += block->size - sizeof(MallocMetadata);
+    tags[tag].live_blocks++;
+    if (new_allocation)
     {
-        size_t mmap_size = ((block->size + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
-        FreeList::getInstance().addToatalAllocatedBytes(-(block->size - sizeof(MallocMetadata)));
-        FreeList::getInstance().decreaseToatalBlocks();
-        block->is_free = true;
-        munmap(block,mmap_size);
-        return;
+        tags[tag].allocations++;
     }
-    if (!block->is_free) 
+}
+
+void TagTable::remove(MallocMetadata* block)
+{
+    tags[block->tag].live_bytes -= block->size - sizeof(MallocMetadata);
+    tags[block->tag].live_blocks--;
+    block->tag = 0;
+}
+
+const SmallocTagStats& TagTable::get(uint8_t tag)
+{
+    return tags[tag];
+}
+
+void TagTable::print()
+{
+    for (int tag = 1; tag < SMALLOC_MAX_TAGS; tag++)
     {
-        block->is_free = true;
-        int order = ceil(log2(block->size)) - 7;
-        if (order < 0)
+        if (tags[tag].allocations == 0)
         {
-            order = 0;
-        }
-        // Merge
-        MallocMetadata* buddy = (MallocMetadata*)((size_t)(block) ^ block->size);
-        while (buddy != NULL && buddy->is_free && buddy->size == block->size && order < MAX_ORDER) 
-        {
-            FreeList::getInstance().decreaseToatalBlocks();
-            FreeList::getInstance().addToatalAllocatedBytes(sizeof(MallocMetadata));
-            FreeList::getInstance().removeBlock(buddy, order);
-            buddy->is_free = true;
-            buddy->size *= 2;
-            block->size *= 2;
-            order++;
-            if ((void*)buddy < (void*)block)
-            {
-                block = buddy;
-            }
-            buddy = (MallocMetadata*)((size_t)(block) ^ block->size);
+            continue;
         }
-        FreeList::getInstance().insertBlock(block, order);
+        printf("tag %-3d live_bytes=%zu live_blocks=%zu allocations=%zu\n", tag,
+               tags[tag].live_bytes, tags[tag].live_blocks, tags[tag].allocations);
     }
 }
 
-void* srealloc(void* oldp, size_t size)
-{
-    if ((size == 0) || (size > pow(10, 8)))
+////////////////////////////////////Free,Lists//////////////////////////////////
+
+class FreeList {
+    MallocMetadata* free_lists[MAX_ORDER + 1];
+    size_t free_blocks_num[MAX_ORDER + 1];
+    size_t total_blocks;
+    size_t total_allocated_bytes;
+    size_t mmap_blocks;
+    size_t mmap_bytes;
+    size_t mmap_threshold; // bigger blocks are mmapped, smaller ones up to it are runs of max-order blocks
+    size_t mmap_threshold_max;
+    bool mmap_threshold_dynamic;
+    unsigned int arena_flags;
+    pthread_mutex_t mutex; // held by every public call on the heap, whatever the thread
+    pthread_t owner; // the thread that initialized the heap, the only one draining remote frees
+    MallocMetadata* remote_frees; // lock-free stack of blocks other threads freed
+    TagTable tags;
+    AllocPath path; // the slowest path of the operation in progress, for the histograms
+    bool timed; // false for the shared heap, whose operations are never recorded
+    bool fixed; // lives in caller memory, never grows and never maps blocks of its own
+    bool initialized;
+    FreeList() : free_lists{NULL}, free_blocks_num{0}, total_blocks(0), total_allocated_bytes(0),
+                 mmap_blocks(0), mmap_bytes(0), mmap_threshold(MAX_BLOCK_SIZE),
+                 mmap_threshold_max(DEFAULT_MMAP_THRESHOLD_MAX), mmap_threshold_dynamic(true), arena_flags(0),
+                 owner(), remote_frees(NULL), tags(), path(PATH_BUDDY), timed(true), fixed(false),
+                 initialized(false)
     {
-        return NULL;
+        pthread_mutex_init(&mutex, NULL);
     }
-    MallocMetadata* oldp_mmd = (MallocMetadata*)((char*)(oldp) - sizeof(MallocMetadata));
-    if (oldp_mmd == NULL || oldp == NULL)
+    static void lockBeforeFork();
+    static void unlockAfterFork();
+    static void adoptInChild();
+public:
+    static FreeList& getInstance() // make FreeList
     {
-        return smalloc(size);
+        static FreeList instance; // Guaranteed to be destroyed.
+        // Instantiated on first use.
+        return instance;
     }
-    if (oldp_mmd->size > MAX_BLOCK_SIZE)
+    static FreeList* createAt(void* where); // make FreeList inside caller memory (heap instances, shared heap)
+    static int getOrder(size_t block_size);
+    MallocMetadata* getFreeList(int i);
+    size_t getFreeBlocksNum(int i);
+    size_t getToatalBlocks();
+    void increaseToatalBlocks();
+    void decreaseToatalBlocks();
+    size_t getToatalAllocatedBytes();
+    void addToatalAllocatedBytes(size_t add);
+    void addMmapBlock(size_t bytes);
+    void removeMmapBlock(size_t bytes);
+    size_t getMmapBlocks();
+    size_t getMmapBytes();
+    size_t getMmapThreshold();
+    void setMmapThreshold(size_t threshold);
+    void setMmapThresholdMax(size_t threshold_max);
+    void updateMmapThreshold(size_t freed_block_size);
+    void setArenaFlags(unsigned int flags);
+    void prepareArena(void* base, size_t size);
+    bool isInitialized();
+    bool isFixed();
+    bool isOwner();
+    void lockHeap();
+    void unlockHeap();
+    bool tryLockHeap();
+    TagTable& getTags();
+    void setTimed(bool timed);
+    void resetPath();
+    void notePath(AllocPath path);
+    AllocPath getPath();
+    void pushRemoteFree(MallocMetadata* block);
+    MallocMetadata* takeRemoteFrees();
+    void* initializeFreeLists();
+    void addArena(void* base, size_t blocks_num);
+    bool addSbrkArena(size_t block_size);
+    void* allocateBlock(int order);
+    void splitBlock(MallocMetadata* block, int order);
+    MallocMetadata* growBlock(MallocMetadata* block, size_t block_size);
+    bool reserveBlocks(const size_t* order_counts);
+    void releaseBlock(MallocMetadata* block);
+    void* allocateRun(size_t block_size);
+    void releaseRun(MallocMetadata* block);
+    void insertBlock(MallocMetadata* block, int order);
+    void removeBlock(MallocMetadata* block, int order);
+};
+
+// the caller adds the arenas, the creating thread owns the lists
+FreeList* FreeList::createAt(void* where)
+{
+    FreeList* heap = new (where) FreeList();
+    heap->fixed = true;
+    heap->owner = pthread_self();
+    heap->initialized = true;
+    return heap;
+}
+
+int FreeList::getOrder(size_t block_size)
+{
+    int order = ceil(log2(block_size)) - 7;
+    if (order < 0)
     {
-        if (size + sizeof(MallocMetadata) == oldp_mmd->size)
-        {
-            return oldp;
-        }
-        void* reallocated_mmap_block = smalloc(size);
-        if (reallocated_mmap_block == NULL)
-        {
+        order = 0;
+    }
+    return order;
+}
+
+MallocMetadata* FreeList::getFreeList(int i)
+{
+    return this->free_lists[i];
+}
+
+size_t FreeList::getFreeBlocksNum(int i)
+{
+    return this->free_blocks_num[i];
+}
+
+size_t FreeList::getToatalBlocks()
+{
+    return this->total_blocks;
+}
+
+void FreeList::increaseToatalBlocks()
+{
+    this->total_blocks++;
+}
+
+void FreeList::decreaseToatalBlocks()
+{
+    this->total_blocks--;
+}
+
+size_t FreeList::getToatalAllocatedBytes()
+{
+    return this->total_allocated_bytes;
+}
+
+void FreeList::addToatalAllocatedBytes(size_t add)
+{
+    this->total_allocated_bytes += add;
+}
+
+void FreeList::addMmapBlock(size_t bytes)
+{
+    this->mmap_blocks++;
+    this->mmap_bytes += bytes;
+}
+
+void FreeList::removeMmapBlock(size_t bytes)
+{
+    this->mmap_blocks--;
+    this->mmap_bytes -= bytes;
+}
+
+size_t FreeList::getMmapBlocks()
+{
+    return this->mmap_blocks;
+}
+
+size_t FreeList::getMmapBytes()
+{
+    return this->mmap_bytes;
+}
+
+size_t FreeList::getMmapThreshold()
+{
+    return this->mmap_threshold;
+}
+
+// a fixed threshold stops the sliding, like M_MMAP_THRESHOLD in glibc
+void FreeList::setMmapThreshold(size_t threshold)
+{
+    this->mmap_threshold = threshold < MAX_BLOCK_SIZE ? MAX_BLOCK_SIZE : threshold;
+    this->mmap_threshold_dynamic = false;
+}
+
+void FreeList::setMmapThresholdMax(size_t threshold_max)
+{
+    this->mmap_threshold_max = threshold_max < MAX_BLOCK_SIZE ? MAX_BLOCK_SIZE : threshold_max;
+    if (this->mmap_threshold > this->mmap_threshold_max)
+    {
+        this->mmap_threshold = this->mmap_threshold_max;
+    }
+}
+
+// Freeing an mmapped block raises the threshold to its size, so the next requests
+// of that size are served from the buddy arenas instead of new mappings.
+void FreeList::updateMmapThreshold(size_t freed_block_size)
+{
+    if (mmap_threshold_dynamic && freed_block_size > mmap_threshold && freed_block_size <= mmap_threshold_max)
+    {
+        mmap_threshold = freed_block_size;
+    }
+}
+
+void FreeList::setArenaFlags(unsigned int flags)
+{
+    this->arena_flags = flags & (SMALLOC_PREFAULT | SMALLOC_HUGEPAGE);
+}
+
+// applies the arena flags to a freshly reserved arena
+void FreeList::prepareArena(void* base, size_t size)
+{
+    if (arena_flags & SMALLOC_HUGEPAGE)
+    {
+        madvise(base, size, MADV_HUGEPAGE);
+    }
+    if (arena_flags & SMALLOC_PREFAULT)
+    {
+        prefaultRange(base, size);
+    }
+}
+
+bool FreeList::isInitialized()
+{
+    return this->initialized;
+}
+
+bool FreeList::isFixed()
+{
+    return this->fixed;
+}
+
+bool FreeList::isOwner()
+{
+    return pthread_equal(this->owner, pthread_self());
+}
+
+void FreeList::lockHeap()
+{
+    pthread_mutex_lock(&mutex);
+}
+
+void FreeList::unlockHeap()
+{
+    pthread_mutex_unlock(&mutex);
+}
+
+bool FreeList::tryLockHeap()
+{
+    return pthread_mutex_trylock(&mutex) == 0;
+}
+
+TagTable& FreeList::getTags()
+{
+    return this->tags;
+}
+
+void FreeList::setTimed(bool timed)
+{
+    this->timed = timed;
+}
+
+// called under the heap lock when a recorded operation starts
+void FreeList::resetPath()
+{
+    this->path = PATH_BUDDY;
+}
+
+void FreeList::notePath(AllocPath path)
+{
+    // a split or merge outranks the plain buddy path, mmap is never mixed with them
+    if (timed && (path > this->path || path == PATH_MMAP))
+    {
+        this->path = path;
+    }
+}
+
+AllocPath FreeList::getPath()
+{
+    return this->path;
+}
+
+// called by foreign threads that found the heap busy, one CAS per block
+void FreeList::pushRemoteFree(MallocMetadata* block)
+{
+    MallocMetadata* head = __atomic_load_n(&remote_frees, __ATOMIC_RELAXED);
+    do
+    {
+        block->next = head;
+    } while (!__atomic_compare_exchange_n(&remote_frees, &head, block, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// called by the owner, detaches the whole batch at once
+MallocMetadata* FreeList::takeRemoteFrees()
+{
+    if (__atomic_load_n(&remote_frees, __ATOMIC_RELAXED) == NULL)
+    {
+        return NULL;
+    }
+    return __atomic_exchange_n(&remote_frees, (MallocMetadata*)NULL, __ATOMIC_ACQUIRE);
+}
+
+// no other thread may be in the middle of an operation while the heap is copied
+void FreeList::lockBeforeFork()
+{
+    getInstance().lockHeap();
+}
+
+void FreeList::unlockAfterFork()
+{
+    getInstance().unlockHeap();
+}
+
+// the forking thread is the only thread of the child, so it owns the child's heap
+void FreeList::adoptInChild()
+{
+    FreeList& heap = getInstance();
+    heap.owner = pthread_self();
+    heap.unlockHeap(); // taken by lockBeforeFork in this same thread
+}
+
+void* FreeList::initializeFreeLists() 
+{
+    void* base = sbrk(0);
+    if (base == (void*)-1) 
+    {
+        return NULL;
+    }
+    uintptr_t base_addr = (uintptr_t)base;
+    uintptr_t aligned_brk_addr = (base_addr+ ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    size_t offset = aligned_brk_addr - base_addr;
+    if (sbrk(offset + ALIGNMENT) == (void*)-1) 
+    {
+        return NULL;
+    }
+    for (int i = 0; i <= MAX_ORDER; i++)
+    {
+        free_lists[i] = NULL;
+    }
+    prepareArena((void*)aligned_brk_addr, ALIGNMENT);
+    addArena((void*)aligned_brk_addr, 32);
+    owner = pthread_self();
+    pthread_atfork(lockBeforeFork, unlockAfterFork, adoptInChild);
+    const char* threshold_max = getenv("SMALLOC_MMAP_THRESHOLD_MAX");
+    if (threshold_max != NULL)
+    {
+        setMmapThresholdMax(strtoul(threshold_max, NULL, 10));
+    }
+    const char* threshold = getenv("SMALLOC_MMAP_THRESHOLD");
+    if (threshold != NULL)
+    {
+        setMmapThreshold(strtoul(threshold, NULL, 10));
+    }
+    initialized = true;
+    return base;
+}
+
+// base must be MAX_BLOCK_SIZE aligned, every block joins the MAX_ORDER list
+void FreeList::addArena(void* base, size_t blocks_num)
+{
+    MallocMetadata* block = (MallocMetadata*)base;
+    for (size_t i = 0; i < blocks_num; i++)
+    {
+        block->size = MAX_BLOCK_SIZE;
+        block->is_free = true;
+        block->is_mmap = false;
+        insertBlock(block, MAX_ORDER);
+        block = (MallocMetadata*)((char*)block + MAX_BLOCK_SIZE);
+    }
+    total_blocks += blocks_num;
+    total_allocated_bytes += blocks_num * (MAX_BLOCK_SIZE - sizeof(MallocMetadata));
+}
+
+// grow the heap with a new arena big enough for a run of block_size bytes
+bool FreeList::addSbrkArena(size_t block_size)
+{
+    void* base = sbrk(0);
+    if (base == (void*)-1)
+    {
+        return false;
+    }
+    uintptr_t base_addr = (uintptr_t)base;
+    uintptr_t aligned_brk_addr = (base_addr + MAX_BLOCK_SIZE - 1) & ~(uintptr_t)(MAX_BLOCK_SIZE - 1);
+    size_t arena_size = ((block_size + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+    if (sbrk(aligned_brk_addr - base_addr + arena_size) == (void*)-1)
+    {
+        return false;
+    }
+    prepareArena((void*)aligned_brk_addr, arena_size);
+    addArena((void*)aligned_brk_addr, arena_size / MAX_BLOCK_SIZE);
+    return true;
+}
+
+void* FreeList::allocateBlock(int order)
+{
+    for (int i = order; i <= MAX_ORDER; i++) 
+    {
+        MallocMetadata* block = free_lists[i];
+        if (block) 
+        {
+            removeBlock(block,i);
+            block->is_free = false;
+            block->handle = 0;
+            block->tag = 0;
+            splitBlock(block, order);
+            return (char*)(block) + sizeof(MallocMetadata);
+        }
+    }
+    return NULL;
+}
+
+// Split block down to the given order, the upper halves go back to the free lists
+void FreeList::splitBlock(MallocMetadata* block, int order)
+{
+    int i = getOrder(block->size);
+    if (i > order)
+    {
+        notePath(PATH_SPLIT);
+    }
+    while (i > order) 
+    {
+        total_blocks++;
+        MallocMetadata* buddy = (MallocMetadata*)((size_t)(block) ^ (block->size/2));
+        buddy->size = block->size / 2;
+        buddy->is_free = true;
+        buddy->is_mmap = false;
+        buddy->next = NULL;
+        buddy->prev = NULL;
+        insertBlock(buddy,i-1);
+        block->size /= 2;
+        total_allocated_bytes -= sizeof(MallocMetadata);
+        i--;
+    }
+}
+
+// Merge a used block with its free buddies until it holds block_size bytes.
+// Returns the merged block (lower buddies move its start down, the caller moves
+// the payload) or NULL, without touching anything, when the buddies don't allow it.
+MallocMetadata* FreeList::growBlock(MallocMetadata* block, size_t block_size)
+{
+    MallocMetadata* merged = block;
+    size_t merged_size = block->size;
+    int order = getOrder(merged_size);
+    while (merged_size < block_size)
+    {
+        MallocMetadata* buddy = (MallocMetadata*)((size_t)(merged) ^ merged_size);
+        if (order >= MAX_ORDER || !buddy->is_free || buddy->size != merged_size)
+        {
             return NULL;
         }
-        memmove(reallocated_mmap_block,oldp,oldp_mmd->size - sizeof(MallocMetadata));
-        sfree(oldp);
-        return reallocated_mmap_block;
+        if (buddy < merged)
+        {
+            merged = buddy;
+        }
+        merged_size *= 2;
+        order++;
     }
-    if (oldp_mmd->size < size + sizeof(MallocMetadata))
+    uint32_t handle = block->handle;
+    uint8_t tag = block->tag;
+    order = getOrder(block->size);
+    notePath(PATH_MERGE);
+    while (block->size < block_size)
     {
-        int order = ceil(log2(oldp_mmd->size)) - 7;
-        if (order < 0)
+        MallocMetadata* buddy = (MallocMetadata*)((size_t)(block) ^ block->size);
+        total_blocks--;
+        total_allocated_bytes += sizeof(MallocMetadata);
+        removeBlock(buddy, order);
+        if (buddy < block)
         {
-            order = 0;
+            buddy->size = block->size;
+            block = buddy;
         }
-        // Merge
-        MallocMetadata* buddy = (MallocMetadata*)((size_t)(oldp_mmd) ^ oldp_mmd->size);
-        while (buddy != NULL && buddy->is_free && buddy->size == oldp_mmd->size && order < MAX_ORDER) 
+        block->size *= 2;
+        order++;
+    }
+    block->is_free = false;
+    block->handle = handle;
+    block->tag = tag;
+    return block;
+}
+
+// Splits ahead of time so every order has at least order_counts[order] free blocks,
+// then faults them in. Lower orders go first: a split only takes blocks of higher
+// orders, and the halves it leaves behind count towards their reservations.
+bool FreeList::reserveBlocks(const size_t* order_counts)
+{
+    for (int order = 0; order <= MAX_ORDER; order++)
+    {
+        while (free_blocks_num[order] < order_counts[order])
         {
-            FreeList::getInstance().decreaseToatalBlocks();
-            FreeList::getInstance().addToatalAllocatedBytes(sizeof(MallocMetadata));
-            FreeList::getInstance().removeBlock(buddy, order);
-            buddy->is_free = true;
-            buddy->size *= 2;
-            oldp_mmd->size *= 2;
-            order++;
-            if (buddy < oldp_mmd)
+            int source = order + 1;
+            while (source <= MAX_ORDER && free_lists[source] == NULL)
             {
-                oldp_mmd->is_free = true;
-                oldp_mmd = buddy;
-                oldp_mmd->is_free = false;
+                source++;
             }
-            buddy = (MallocMetadata*)((size_t)(oldp_mmd) ^ oldp_mmd->size);
-            if (oldp_mmd->size >= size + sizeof(MallocMetadata))
+            if (source > MAX_ORDER)
             {
-                return (char*)oldp_mmd + sizeof(MallocMetadata);
+                if (fixed || !addSbrkArena(MAX_BLOCK_SIZE))
+                {
+                    return false;
+                }
+                continue;
             }
+            MallocMetadata* block = free_lists[source];
+            removeBlock(block, source);
+            splitBlock(block, order);
+            insertBlock(block, order);
         }
-        void* reallocated_block = smalloc(size);
-        if (reallocated_block == NULL)
+    }
+    for (int order = 0; order <= MAX_ORDER; order++)
+    {
+        MallocMetadata* block = free_lists[order];
+        for (size_t i = 0; i < order_counts[order] && block != NULL; i++)
         {
-            return NULL;
+            prefaultRange(block, block->size);
+            block = block->next;
         }
-        memmove(reallocated_block,oldp,oldp_mmd->size - sizeof(MallocMetadata));
-        sfree(oldp);
-        return reallocated_block;
     }
-    else 
+    return true;
+}
+
+void FreeList::releaseBlock(MallocMetadata* block)
+{
+    if (block->is_free)
     {
-        return oldp;
+        return;
+    }
+    block->is_free = true;
+    int order = getOrder(block->size);
+    // Merge
+    MallocMetadata* buddy = (MallocMetadata*)((size_t)(block) ^ block->size);
+    // max-order blocks have no buddy, and in a heap over caller memory the address may not be mapped
+    while (order < MAX_ORDER && buddy->is_free && buddy->size == block->size) 
+    {
+        notePath(PATH_MERGE);
+        total_blocks--;
+        total_allocated_bytes += sizeof(MallocMetadata);
+        removeBlock(buddy, order);
+        buddy->is_free = true;
+        buddy->size *= 2;
+        block->size *= 2;
+        order++;
+        if ((void*)buddy < (void*)block)
+        {
+            block = buddy;
+        }
+        buddy = (MallocMetadata*)((size_t)(block) ^ block->size);
+    }
+    insertBlock(block, order);
+}
+
+// Serves blocks bigger than MAX_BLOCK_SIZE out of adjacent MAX_ORDER blocks.
+// The MAX_ORDER list is sorted, so a run is a chain of neighbours in the list.
+void* FreeList::allocateRun(size_t block_size)
+{
+    size_t blocks_num = (block_size + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE;
+    MallocMetadata* first = free_lists[MAX_ORDER];
+    while (first)
+    {
+        MallocMetadata* last = first;
+        size_t run = 1;
+        while (run < blocks_num && last->next == (MallocMetadata*)((char*)last + MAX_BLOCK_SIZE))
+        {
+            last = last->next;
+            run++;
+        }
+        if (run == blocks_num)
+        {
+            MallocMetadata* after = last->next;
+            if (first->prev)
+            {
+                first->prev->next = after;
+            }
+            else
+            {
+                free_lists[MAX_ORDER] = after;
+            }
+            if (after)
+            {
+                after->prev = first->prev;
+            }
+            free_blocks_num[MAX_ORDER] -= blocks_num;
+            first->size = blocks_num * MAX_BLOCK_SIZE;
+            first->is_free = false;
+            first->handle = 0;
+            first->tag = 0;
+            total_blocks -= blocks_num - 1;
+            total_allocated_bytes += (blocks_num - 1) * sizeof(MallocMetadata);
+            return (char*)(first) + sizeof(MallocMetadata);
+        }
+        first = last->next;
+    }
+    return NULL;
+}
+
+void FreeList::releaseRun(MallocMetadata* block)
+{
+    size_t blocks_num = block->size / MAX_BLOCK_SIZE;
+    // the parts are adjacent, so they enter the sorted list as one chain
+    MallocMetadata* prev = NULL;
+    MallocMetadata* current = free_lists[MAX_ORDER];
+    while (current && current < block)
+    {
+        prev = current;
+        current = current->next;
     }
+    for (size_t i = 0; i < blocks_num; i++)
+    {
+        MallocMetadata* part = (MallocMetadata*)((char*)block + i * MAX_BLOCK_SIZE);
+        part->size = MAX_BLOCK_SIZE;
+        part->is_free = true;
+        part->is_mmap = false;
+        part->prev = prev;
+        if (prev)
+        {
+            prev->next = part;
+        }
+        else
+        {
+            free_lists[MAX_ORDER] = part;
+        }
+        prev = part;
+    }
+    prev->next = current;
+    if (current)
+    {
+        current->prev = prev;
+    }
+    free_blocks_num[MAX_ORDER] += blocks_num;
+    total_blocks += blocks_num - 1;
+    total_allocated_bytes -= (blocks_num - 1) * sizeof(MallocMetadata);
 }
 
+void FreeList::insertBlock(MallocMetadata* block, int order) 
+{
+    free_blocks_num[order]++;
+    if (free_lists[order] == NULL) 
+    {
+        free_lists[order] = block;
+        block->prev = NULL;
+        block->next = NULL;
+    } 
+    else 
+    {
+        MallocMetadata* current = free_lists[order];
+        while (current && (char*)current < (char*)block) 
+        {
+            current = current->next;
+        }
+        if (current) 
+        {
+            block->next = current;
+            block->prev = current->prev;
+            if (current->prev) 
+            {
+                current->prev->next = block;
+            } 
+            else 
+            {
+                free_lists[order] = block;
+            }
+            current->prev = block;
+        } 
+        else 
+        {
+            MallocMetadata* tail = free_lists[order];
+            while (tail->next)
+            {
+                tail = tail->next;
+            }
+            tail->next = block;
+            block->prev = tail;
+            block->next = NULL;
+        }
+    }
+}
+
+void FreeList::removeBlock(MallocMetadata* block, int order)
+{
+    free_blocks_num[order]--;
+    if (block->prev) 
+    {
+        block->prev->next = block->next;
+    } 
+    else 
+    {
+        free_lists[order] = block->next;
+    }
+    if (block->next) 
+    {
+        block->next->prev = block->prev;
+    }
+}
+
+////////////////////////////////////Heap,Instances//////////////////////////////////
+
+// A heap instance. The default heap grows with sbrk and mmap, the others are
+// placed at the start of the caller memory they manage and never grow past it.
+struct sheap {
+    FreeList* lists;
+    char* arenas; // NULL for the default heap
+    size_t arenas_size;
+};
+
+static sheap* defaultHeap()
+{
+    static sheap instance = { &FreeList::getInstance(), NULL, 0 };
+    return &instance;
+}
+
+sheap* sheap_default()
+{
+    return defaultHeap();
+}
+
+size_t sheap_num_free_blocks(sheap* heap)
+{
+    size_t count = 0;
+    heap->lists->lockHeap();
+    for (int i = 0; i <= MAX_ORDER; i++) 
+    {
+        MallocMetadata* block = heap->lists->getFreeList(i);
+        while (block) 
+        {
+            count++;
+            block = block->next;
+        }
+    }
+    heap->lists->unlockHeap();
+    return count;
+}
+
+size_t sheap_num_free_bytes(sheap* heap)
+{
+    size_t count = 0;
+    heap->lists->lockHeap();
+    for (int i = 0; i <= MAX_ORDER; i++) 
+    {
+        MallocMetadata* block = heap->lists->getFreeList(i);
+        while (block) 
+        {
+            count += (block->size - sizeof(MallocMetadata));
+            block = block->next;
+        }
+    }
+    heap->lists->unlockHeap();
+    return count;
+}
+
+size_t sheap_num_allocated_blocks(sheap* heap)
+{
+    return heap->lists->getToatalBlocks();
+}
+
+size_t sheap_num_allocated_bytes(sheap* heap)
+{
+    return heap->lists->getToatalAllocatedBytes();
+}
+
+////////////////////////////////////5-10,Functions//////////////////////////////////
+
+size_t _num_free_blocks()
+{
+    return sheap_num_free_blocks(defaultHeap());
+}
+
+size_t _num_free_bytes() 
+{
+    return sheap_num_free_bytes(defaultHeap());
+}
+
+size_t _num_allocated_blocks() 
+{
+    return sheap_num_allocated_blocks(defaultHeap());
+}
+
+size_t _num_allocated_bytes() 
+{
+    return sheap_num_allocated_bytes(defaultHeap());
+}
+
+size_t _num_meta_data_bytes() 
+{
+    return FreeList::getInstance().getToatalBlocks() * sizeof(MallocMetadata);
+}
+
+size_t _size_meta_data() 
+{
+    return sizeof(MallocMetadata);
+}
+
+////////////////////////////////////Mmap,Threshold//////////////////////////////////
+
+// Thresholds are block sizes (payload + metadata), also settable through the
+// SMALLOC_MMAP_THRESHOLD and SMALLOC_MMAP_THRESHOLD_MAX environment variables.
+size_t _mmap_threshold()
+{
+    return FreeList::getInstance().getMmapThreshold();
+}
+
+void _set_mmap_threshold(size_t threshold)
+{
+    FreeList::getInstance().setMmapThreshold(threshold);
+}
+
+void _set_mmap_threshold_max(size_t threshold_max)
+{
+    FreeList::getInstance().setMmapThresholdMax(threshold_max);
+}
+
+// must be set before the first allocation to cover the initial arena
+void _set_arena_flags(unsigned int flags)
+{
+    FreeList::getInstance().setArenaFlags(flags);
+}
+
+////////////////////////////////////Stats,Page//////////////////////////////////
+
+// Publishes the counters of the default heap to /dev/shm/smalloc_stats.<pid> so
+// smalloc_stat can read them from outside. Opt-in with _stats_publish(true) or by
+// running with SMALLOC_STATS set in the environment.
+class StatsPage {
+    MallocStats* page;
+    char path[64];
+    bool atfork_registered;
+    StatsPage() : page(NULL), path{0}, atfork_registered(false) {}
+    static void detachInChild();
+public:
+    static StatsPage& getInstance() // make StatsPage
+    {
+        static StatsPage instance; // Guaranteed to be destroyed.
+        // Instantiated on first use.
+        return instance;
+    }
+    ~StatsPage();
+    bool attach();
+    void detach();
+    void publish();
+};
+
+StatsPage::~StatsPage()
+{
+    detach();
+}
+
+// the child must neither overwrite nor unlink the page of its parent
+void StatsPage::detachInChild()
+{
+    StatsPage& stats = getInstance();
+    if (stats.page != NULL)
+    {
+        munmap(stats.page, sizeof(MallocStats));
+        stats.page = NULL;
+    }
+    stats.path[0] = '\0';
+}
+
+bool StatsPage::attach()
+{
+    if (page != NULL)
+    {
+        return true;
+    }
+    snprintf(path, sizeof(path), "%s/%s%d", MALLOC_STATS_DIR, MALLOC_STATS_PREFIX, getpid());
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        path[0] = '\0';
+        return false;
+    }
+    if (ftruncate(fd, sizeof(MallocStats)) == -1)
+    {
+        close(fd);
+        unlink(path);
+        path[0] = '\0';
+        return false;
+    }
+    void* mapped = mmap(NULL, sizeof(MallocStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        unlink(path);
+        path[0] = '\0';
+        return false;
+    }
+    if (!atfork_registered)
+    {
+        pthread_atfork(NULL, NULL, detachInChild);
+        atfork_registered = true;
+    }
+    page = (MallocStats*)mapped;
+    page->pid = getpid();
+    publish();
+    __atomic_store_n(&page->magic, MALLOC_STATS_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+void StatsPage::detach()
+{
+    if (page != NULL)
+    {
+        munmap(page, sizeof(MallocStats));
+        page = NULL;
+    }
+    if (path[0] != '\0')
+    {
+        unlink(path);
+        path[0] = '\0';
+    }
+}
+
+void StatsPage::publish()
+{
+    if (page == NULL)
+    {
+        return;
+    }
+    FreeList& heap = FreeList::getInstance();
+    size_t free_blocks = 0;
+    size_t free_bytes = 0;
+    mallocStatsWriteBegin(page);
+    for (int i = 0; i <= MAX_ORDER; i++)
+    {
+        size_t blocks_num = heap.getFreeBlocksNum(i);
+        size_t payload = (MAX_BLOCK_SIZE >> (MAX_ORDER - i)) - sizeof(MallocMetadata);
+        page->free_blocks_per_order[i] = blocks_num;
+        free_blocks += blocks_num;
+        free_bytes += blocks_num * payload;
+    }
+    size_t max_order_free_bytes = heap.getFreeBlocksNum(MAX_ORDER) * (MAX_BLOCK_SIZE - sizeof(MallocMetadata));
+    page->allocated_blocks = heap.getToatalBlocks();
+    page->allocated_bytes = heap.getToatalAllocatedBytes();
+    page->free_blocks = free_blocks;
+    page->free_bytes = free_bytes;
+    page->mmap_blocks = heap.getMmapBlocks();
+    page->mmap_bytes = heap.getMmapBytes();
+    page->max_order_free_bytes = max_order_free_bytes;
+    page->fragmentation_permille = free_bytes ? 1000 - max_order_free_bytes * 1000 / free_bytes : 0;
+    mallocStatsWriteEnd(page);
+}
+
+bool _stats_publish(bool enable)
+{
+    FreeList& heap = FreeList::getInstance();
+    heap.lockHeap();
+    bool published = true;
+    if (!enable)
+    {
+        StatsPage::getInstance().detach();
+    }
+    else
+    {
+        published = StatsPage::getInstance().attach();
+    }
+    heap.unlockHeap();
+    return published;
+}
+
+////////////////////////////////////Histograms,Functions//////////////////////////////////
+
+void _histograms_enable(bool enable)
+{
+    Histograms::getInstance().enable(enable);
+}
+
+void _histograms_reset()
+{
+    Histograms::getInstance().reset();
+}
+
+// op is an AllocOperation, path an AllocPath, bucket in [0, HISTOGRAM_BUCKETS)
+size_t _histogram_count(int op, int path, int bucket)
+{
+    return Histograms::getInstance().getCount((AllocOperation)op, (AllocPath)path, bucket);
+}
+
+size_t _histogram_percentile_ns(int op, int path, double percentile)
+{
+    return Histograms::getInstance().getPercentile((AllocOperation)op, (AllocPath)path, percentile);
+}
+
+void _histograms_print()
+{
+    Histograms::getInstance().print();
+}
+
+////////////////////////////////////Tags,Functions//////////////////////////////////
+
+// the tags of the default heap, the one smalloc_tagged allocates from
+bool _tag_stats(unsigned int tag_id, SmallocTagStats* stats)
+{
+    if (tag_id == 0 || tag_id >= SMALLOC_MAX_TAGS || stats == NULL)
+    {
+        return false;
+    }
+    FreeList::getInstance().lockHeap();
+    *stats = FreeList::getInstance().getTags().get(tag_id);
+    FreeList::getInstance().unlockHeap();
+    return true;
+}
+
+void _tags_print()
+{
+    FreeList::getInstance().lockHeap();
+    FreeList::getInstance().getTags().print();
+    FreeList::getInstance().unlockHeap();
+}
+
+////////////////////////////////////Growable,Buffers//////////////////////////////////
+
+// The default heap is set up by the first call that needs it.
+static bool initializeHeap(FreeList& heap)
+{
+    if (heap.isInitialized())
+    {
+        return true;
+    }
+    if (!heap.initializeFreeLists())
+    {
+        return false;
+    }
+    if (getenv("SMALLOC_STATS") != NULL)
+    {
+        StatsPage::getInstance().attach();
+    }
+    return true;
+}
+
+// A growable buffer reserves its whole address range PROT_NONE up front and
+// commits pages as it grows, so the payload never moves. The reservation starts
+// with this header followed by the block metadata, the payload comes right after.
+typedef struct GrowableMetadata {
+    size_t reserved_size; // bytes of address space, headers included
+    size_t committed_size; // readable and writable prefix, a multiple of PAGE_SIZE
+} GrowableMetadata;
+
+#define GROWABLE_HEADER_SIZE (sizeof(GrowableMetadata) + sizeof(MallocMetadata))
+
+static GrowableMetadata* growableOf(MallocMetadata* block)
+{
+    return (GrowableMetadata*)((char*)(block) - sizeof(GrowableMetadata));
+}
+
+// Commits or decommits pages so the payload holds exactly new_len bytes. Everything
+// committed past the length is zero, so bytes past the old length read as zero.
+static bool resizeGrowable(FreeList& heap, MallocMetadata* block, size_t new_len)
+{
+    GrowableMetadata* growable = growableOf(block);
+    if (new_len > growable->reserved_size - GROWABLE_HEADER_SIZE)
+    {
+        return false;
+    }
+    char* base = (char*)growable;
+    size_t committed_size = ((GROWABLE_HEADER_SIZE + new_len + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+    if (committed_size > growable->committed_size)
+    {
+        if (mprotect(base + growable->committed_size, committed_size - growable->committed_size,
+                     PROT_READ | PROT_WRITE) == -1)
+        {
+            return false;
+        }
+    }
+    else if (committed_size < growable->committed_size)
+    {
+        // a fresh PROT_NONE mapping returns both the pages and their commit charge
+        if (mmap(base + committed_size, growable->committed_size - committed_size, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    growable->committed_size = committed_size;
+    size_t old_len = block->size - sizeof(MallocMetadata);
+    if (new_len < old_len)
+    {
+        // decommitted pages come back zeroed, the tail of the last kept page is cleared here
+        size_t kept_end = committed_size - GROWABLE_HEADER_SIZE;
+        char* payload = (char*)(block) + sizeof(MallocMetadata);
+        memset(payload + new_len, 0, (old_len < kept_end ? old_len : kept_end) - new_len);
+    }
+    heap.addToatalAllocatedBytes(new_len - old_len);
+    heap.removeMmapBlock(old_len);
+    heap.addMmapBlock(new_len);
+    block->size = new_len + sizeof(MallocMetadata);
+    return true;
+}
+
+static void releaseGrowable(FreeList& heap, MallocMetadata* block)
+{
+    size_t len = block->size - sizeof(MallocMetadata);
+    heap.addToatalAllocatedBytes(-len);
+    heap.decreaseToatalBlocks();
+    heap.removeMmapBlock(len);
+    block->is_free = true;
+    GrowableMetadata* growable = growableOf(block);
+    munmap(growable, growable->reserved_size);
+}
+
+// Returns an empty buffer that sgrowable_resize can grow in place to at least max_bytes.
+// Only the committed length counts as allocated, and sfree releases the buffer.
+void* sgrowable_create(size_t max_bytes)
+{
+    FreeList& heap = FreeList::getInstance();
+    if (max_bytes == 0 || max_bytes > SIZE_MAX - GROWABLE_HEADER_SIZE - PAGE_SIZE)
+    {
+        return NULL;
+    }
+    size_t reserved_size = ((GROWABLE_HEADER_SIZE + max_bytes + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+    void* reserved = mmap(NULL, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (mprotect(reserved, PAGE_SIZE, PROT_READ | PROT_WRITE) == -1)
+    {
+        munmap(reserved, reserved_size);
+        return NULL;
+    }
+    GrowableMetadata* growable = (GrowableMetadata*)reserved;
+    growable->reserved_size = reserved_size;
+    growable->committed_size = PAGE_SIZE;
+    MallocMetadata* block = (MallocMetadata*)((char*)(reserved) + sizeof(GrowableMetadata));
+    block->size = sizeof(MallocMetadata);
+    block->is_free = false;
+    block->is_mmap = true;
+    block->is_growable = true;
+    block->handle = 0;
+    block->tag = 0;
+    heap.lockHeap();
+    if (!initializeHeap(heap))
+    {
+        heap.unlockHeap();
+        munmap(reserved, reserved_size);
+        return NULL;
+    }
+    heap.increaseToatalBlocks();
+    heap.addMmapBlock(0);
+    StatsPage::getInstance().publish();
+    heap.unlockHeap();
+    return (char*)(block) + sizeof(MallocMetadata);
+}
+
+// Bytes past the old length read as zero, the address never changes.
+bool sgrowable_resize(void* buffer, size_t new_len)
+{
+    if (buffer == NULL)
+    {
+        return false;
+    }
+    MallocMetadata* block = (MallocMetadata*)((char*)(buffer) - sizeof(MallocMetadata));
+    if (!block->is_mmap || !block->is_growable)
+    {
+        return false;
+    }
+    FreeList& heap = FreeList::getInstance();
+    heap.lockHeap();
+    bool resized = resizeGrowable(heap, block, new_len);
+    StatsPage::getInstance().publish();
+    heap.unlockHeap();
+    return resized;
+}
+
+////////////////////////////////////1-4,Functions//////////////////////////////////
+
+// applies the smalloc_ex flags to a block served from the arenas
+static void* finishAllocation(void* allocated, size_t size, unsigned int flags)
+{
+    if (allocated == NULL)
+    {
+        return NULL;
+    }
+    if (flags & SMALLOC_ZERO)
+    {
+        bulkZero(allocated, size, flags & SMALLOC_NOCACHE_HINT);
+    }
+    else if (flags & SMALLOC_PREFAULT)
+    {
+        prefaultRange(allocated, size);
+    }
+    return allocated;
+}
+
+static void releaseInternal(FreeList& heap, void* p);
+
+// releases the blocks other threads queued while the heap was busy, under the heap lock
+static void drainRemoteFrees(FreeList& heap)
+{
+    MallocMetadata* remote = heap.takeRemoteFrees();
+    while (remote != NULL)
+    {
+        MallocMetadata* next = remote->next;
+        releaseInternal(heap, (char*)(remote) + sizeof(MallocMetadata));
+        remote = next;
+    }
+}
+
+static void* allocateInternal(FreeList& heap, size_t size, unsigned int flags)
+{
+    if (!initializeHeap(heap))
+    {
+        return NULL;
+    }
+    // only the owner drains, a foreign thread allocating under the lock leaves the queue alone
+    if (heap.isOwner())
+    {
+        drainRemoteFrees(heap);
+    }
+    if ((size == 0) || (size > pow(10, 8))) 
+    {
+        return NULL;
+    }
+    int order = FreeList::getOrder(size + sizeof(MallocMetadata));
+    if (heap.isFixed())
+    {
+        // no mmap and no growth, big blocks can only be runs
+        if (size + sizeof(MallocMetadata) > MAX_BLOCK_SIZE)
+        {
+            return finishAllocation(heap.allocateRun(size + sizeof(MallocMetadata)), size, flags);
+        }
+        return finishAllocation(heap.allocateBlock(order), size, flags);
+    }
+    if (size + sizeof(MallocMetadata) > MAX_BLOCK_SIZE)
+    {
+        if (!(flags & SMALLOC_HUGEPAGE) && size + sizeof(MallocMetadata) <= heap.getMmapThreshold())
+        {
+            void* run = heap.allocateRun(size + sizeof(MallocMetadata));
+            if (run == NULL && heap.addSbrkArena(size + sizeof(MallocMetadata)))
+            {
+                run = heap.allocateRun(size + sizeof(MallocMetadata));
+            }
+            if (run != NULL)
+            {
+                return finishAllocation(run, size, flags);
+            }
+        }
+        heap.notePath(PATH_MMAP);
+        size_t mmap_size = ((size + sizeof(MallocMetadata) + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+        void* ptr = mapBlock(mmap_size, flags);
+        if (ptr == (void *) -1) 
+        {
+            return NULL;
+        }
+        MallocMetadata* block = (MallocMetadata*)(ptr);
+        block->size = size + sizeof(MallocMetadata);
+        block->is_free = false;
+        block->is_mmap = true;
+        block->is_growable = false;
+        block->handle = 0;
+        block->tag = 0;
+        heap.increaseToatalBlocks();
+        heap.addToatalAllocatedBytes(size);
+        heap.addMmapBlock(size);
+        // fresh mappings are already zeroed and mapBlock did the prefault
+        return (char*)(block) + sizeof(MallocMetadata);
+    }
+    return finishAllocation(heap.allocateBlock(order), size, flags);
+}
+
+static void forgetHandle(MallocMetadata* block);
+
+static void releaseInternal(FreeList& heap, void* p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    MallocMetadata* block = (MallocMetadata*)((char*)(p) - sizeof(MallocMetadata));
+    if (block->handle != 0)
+    {
+        // a plain sfree of a pinned handle address, the handle dies with the block
+        forgetHandle(block);
+    }
+    if (block->tag != 0)
+    {
+        heap.getTags().remove(block);
+    }
+    if (block->is_mmap && block->is_growable)
+    {
+        releaseGrowable(heap, block);
+        return;
+    }
+    if (block->is_mmap)
+    {
+        heap.notePath(PATH_MMAP);
+        heap.updateMmapThreshold(block->size);
+        size_t mmap_size = ((block->size + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+        heap.addToatalAllocatedBytes(-(block->size - sizeof(MallocMetadata)));
+        heap.decreaseToatalBlocks();
+        heap.removeMmapBlock(block->size - sizeof(MallocMetadata));
+        block->is_free = true;
+        munmap(block,mmap_size);
+        return;
+    }
+    if (block->size > MAX_BLOCK_SIZE)
+    {
+        heap.releaseRun(block);
+        return;
+    }
+    heap.releaseBlock(block);
+}
+
+static void relocateHandle(MallocMetadata* block);
+
+// A handle block that moves takes its handle along, see relocateHandle.
+static void* reallocateInternal(FreeList& heap, void* oldp, size_t size)
+{
+    if ((size == 0) || (size > pow(10, 8)))
+    {
+        return NULL;
+    }
+    if (oldp == NULL)
+    {
+        return allocateInternal(heap, size, 0);
+    }
+    MallocMetadata* oldp_mmd = (MallocMetadata*)((char*)(oldp) - sizeof(MallocMetadata));
+    size_t old_size = oldp_mmd->size - sizeof(MallocMetadata);
+    size_t block_size = size + sizeof(MallocMetadata);
+    if (oldp_mmd->is_mmap)
+    {
+        if (oldp_mmd->is_growable && resizeGrowable(heap, oldp_mmd, size))
+        {
+            return oldp;
+        }
+        if (block_size == oldp_mmd->size)
+        {
+            return oldp;
+        }
+    }
+    else if (oldp_mmd->size > MAX_BLOCK_SIZE)
+    {
+        // a run keeps serving sizes that need the same number of max-order blocks
+        if (block_size <= oldp_mmd->size && block_size > oldp_mmd->size - MAX_BLOCK_SIZE)
+        {
+            return oldp;
+        }
+    }
+    else if (block_size <= oldp_mmd->size)
+    {
+        // Shrink in place, the upper halves are released
+        heap.splitBlock(oldp_mmd, FreeList::getOrder(block_size));
+        return oldp;
+    }
+    else if (block_size <= MAX_BLOCK_SIZE)
+    {
+        // Grow in place, only merges with lower buddies move the payload
+        MallocMetadata* merged = heap.growBlock(oldp_mmd, block_size);
+        if (merged != NULL)
+        {
+            void* newp = (char*)merged + sizeof(MallocMetadata);
+            if (newp != oldp)
+            {
+                bulkCopy(newp, oldp, old_size);
+                relocateHandle(merged);
+            }
+            return newp;
+        }
+    }
+    void* reallocated_block = allocateInternal(heap, size, 0);
+    if (reallocated_block == NULL)
+    {
+        return NULL;
+    }
+    bulkCopy(reallocated_block, oldp, old_size < size ? old_size : size);
+    if (oldp_mmd->handle != 0)
+    {
+        MallocMetadata* moved = (MallocMetadata*)((char*)(reallocated_block) - sizeof(MallocMetadata));
+        moved->handle = oldp_mmd->handle;
+        oldp_mmd->handle = 0;
+        relocateHandle(moved);
+    }
+    releaseInternal(heap, oldp);
+    return reallocated_block;
+}
+
+// Every public call holds the heap lock. The owner pays an uncontended lock, other
+// threads may allocate too, and their frees never wait (see sheap_free).
+static void* allocateRecorded(sheap* heap, size_t size, unsigned int flags, AllocOperation op, uint8_t tag)
+{
+    if (heap == NULL || heap->lists == NULL)
+    {
+        return NULL;
+    }
+    heap->lists->lockHeap();
+    uint64_t start = Histograms::getInstance().start();
+    heap->lists->resetPath();
+    void* allocated = allocateInternal(*heap->lists, size, flags);
+    if (allocated != NULL && tag != 0)
+    {
+        heap->lists->getTags().add((MallocMetadata*)((char*)(allocated) - sizeof(MallocMetadata)), tag, true);
+    }
+    Histograms::getInstance().record(op, heap->lists->getPath(), start);
+    if (heap == defaultHeap())
+    {
+        StatsPage::getInstance().publish();
+    }
+    heap->lists->unlockHeap();
+    return allocated;
+}
+
+void* sheap_malloc(sheap* heap, size_t size)
+{
+    return allocateRecorded(heap, size, 0, OP_SMALLOC, 0);
+}
+
+void sheap_free(sheap* heap, void* p)
+{
+    if (heap == NULL || heap->lists == NULL || p == NULL)
+    {
+        return;
+    }
+    FreeList& lists = *heap->lists;
+    bool owner = lists.isOwner();
+    if (owner)
+    {
+        lists.lockHeap();
+    }
+    else if (!lists.tryLockHeap())
+    {
+        // the heap is busy, the block waits for the owner's next call
+        lists.pushRemoteFree((MallocMetadata*)((char*)(p) - sizeof(MallocMetadata)));
+        return;
+    }
+    uint64_t start = Histograms::getInstance().start();
+    lists.resetPath();
+    releaseInternal(lists, p);
+    Histograms::getInstance().record(OP_SFREE, lists.getPath(), start);
+    if (owner)
+    {
+        drainRemoteFrees(lists);
+    }
+    if (heap == defaultHeap())
+    {
+        StatsPage::getInstance().publish();
+    }
+    lists.unlockHeap();
+}
+
+void* smalloc(size_t size) 
+{
+    return sheap_malloc(defaultHeap(), size);
+}
+
+void* smalloc_ex(size_t size, unsigned int flags)
+{
+    return allocateRecorded(defaultHeap(), size, flags, OP_SMALLOC, 0);
+}
+
+// tag_id in [1, SMALLOC_MAX_TAGS), see _tag_stats and _tags_print
+void* smalloc_tagged(size_t size, unsigned int tag_id)
+{
+    if (tag_id == 0 || tag_id >= SMALLOC_MAX_TAGS)
+    {
+        return NULL;
+    }
+    return allocateRecorded(defaultHeap(), size, 0, OP_SMALLOC, tag_id);
+}
+
+void* scalloc(size_t num, size_t size)
+{
+    return allocateRecorded(defaultHeap(), num * size, SMALLOC_ZERO, OP_SCALLOC, 0);
+}
+
+void sfree(void* p)
+{
+    sheap_free(defaultHeap(), p);
+}
+
+void* srealloc(void* oldp, size_t size)
+{
+    FreeList& heap = FreeList::getInstance();
+    heap.lockHeap();
+    uint64_t start = Histograms::getInstance().start();
+    heap.resetPath();
+    // the tag follows the data, accounted with the new size wherever it ends up
+    MallocMetadata* old_block = oldp ? (MallocMetadata*)((char*)(oldp) - sizeof(MallocMetadata)) : NULL;
+    uint8_t tag = old_block ? old_block->tag : 0;
+    if (tag != 0)
+    {
+        heap.getTags().remove(old_block);
+    }
+    void* reallocated = reallocateInternal(heap, oldp, size);
+    if (tag != 0)
+    {
+        void* tagged = reallocated != NULL ? reallocated : oldp;
+        heap.getTags().add((MallocMetadata*)((char*)(tagged) - sizeof(MallocMetadata)), tag, false);
+    }
+    Histograms::getInstance().record(OP_SREALLOC, heap.getPath(), start);
+    StatsPage::getInstance().publish();
+    heap.unlockHeap();
+    return reallocated;
+}
+
+////////////////////////////////////Heap,Functions//////////////////////////////////
+
+// Runs a heap over [base, base + len), e.g. a hugepage buffer or a shared mapping.
+// The heap header takes the start of the region and the arenas begin at the next
+// MAX_BLOCK_SIZE boundary, so len must leave room for at least one max-order block.
+sheap* sheap_create(void* base, size_t len)
+{
+    if (base == NULL)
+    {
+        return NULL;
+    }
+    size_t lists_offset = (sizeof(sheap) + 15) & ~(size_t)15;
+    uintptr_t header_end = (uintptr_t)base + lists_offset + sizeof(FreeList);
+    uintptr_t arenas_addr = (header_end + MAX_BLOCK_SIZE - 1) & ~(uintptr_t)(MAX_BLOCK_SIZE - 1);
+    uintptr_t end = (uintptr_t)base + len;
+    if (end < (uintptr_t)base || arenas_addr >= end || end - arenas_addr < MAX_BLOCK_SIZE)
+    {
+        return NULL;
+    }
+    sheap* heap = (sheap*)base;
+    heap->lists = FreeList::createAt((char*)base + lists_offset);
+    heap->arenas = (char*)arenas_addr;
+    heap->arenas_size = ((end - arenas_addr) / MAX_BLOCK_SIZE) * MAX_BLOCK_SIZE;
+    heap->lists->addArena(heap->arenas, heap->arenas_size / MAX_BLOCK_SIZE);
+    return heap;
+}
+
+// order_counts has SMALLOC_ORDERS entries, see FreeList::reserveBlocks. On a heap
+// over caller memory it fails once the region is used up, keeping what it reserved.
+bool sheap_reserve(sheap* heap, const size_t* order_counts)
+{
+    if (heap == NULL || heap->lists == NULL || order_counts == NULL)
+    {
+        return false;
+    }
+    heap->lists->lockHeap();
+    bool reserved = initializeHeap(*heap->lists) && heap->lists->reserveBlocks(order_counts);
+    if (heap == defaultHeap())
+    {
+        StatsPage::getInstance().publish();
+    }
+    heap->lists->unlockHeap();
+    return reserved;
+}
+
+// SMALLOC_RESERVE="c0,c1,...,c10" reserves blocks per order in the default heap
+// before main, so the first requests don't pay for the setup, splits and faults.
+__attribute__((constructor)) static void reserveAtStartup()
+{
+    const char* counts = getenv("SMALLOC_RESERVE");
+    if (counts == NULL)
+    {
+        return;
+    }
+    size_t order_counts[SMALLOC_ORDERS] = {0};
+    for (int order = 0; order < SMALLOC_ORDERS && *counts != '\0'; order++)
+    {
+        char* end;
+        order_counts[order] = strtoul(counts, &end, 10);
+        counts = (*end == ',') ? end + 1 : end;
+    }
+    sheap_reserve(defaultHeap(), order_counts);
+}
+
+// The memory stays the caller's, every block of the heap is gone with it.
+void sheap_destroy(sheap* heap)
+{
+    if (heap == NULL || heap == defaultHeap())
+    {
+        return;
+    }
+    if (heap->lists != NULL)
+    {
+        // blocks freed by other threads at the last moment still leave the accounting
+        heap->lists->lockHeap();
+        drainRemoteFrees(*heap->lists);
+        heap->lists->unlockHeap();
+    }
+    heap->lists = NULL;
+    heap->arenas = NULL;
+    heap->arenas_size = 0;
+}
+
+////////////////////////////////////Shared,Heap//////////////////////////////////
+
+// A buddy heap over a memfd mapping. The mapping is created before fork, so every
+// related process sees it at the same address and pointers can be passed as is.
+// The first page holds the process-shared lock and the FreeList, arenas follow it.
+static_assert(((sizeof(pthread_mutex_t) + 15) & ~(size_t)15) + sizeof(FreeList) <= PAGE_SIZE,
+              "the shared heap header must fit in its page");
+class SharedHeap {
+    pthread_mutex_t* lock;
+    FreeList* heap;
+    char* arenas;
+    size_t arenas_size;
+    SharedHeap() : lock(NULL), heap(NULL), arenas(NULL), arenas_size(0) {}
+    void lockHeap();
+    void unlockHeap();
+public:
+    static SharedHeap& getInstance() // make SharedHeap
+    {
+        static SharedHeap instance; // Guaranteed to be destroyed.
+        // Instantiated on first use.
+        return instance;
+    }
+    void* initialize(size_t size);
+    void* allocate(size_t size);
+    void release(void* p);
+    bool contains(void* p);
+    char* getArenas();
+};
+
+void SharedHeap::lockHeap()
+{
+    // a process died while holding the lock, take it over
+    if (pthread_mutex_lock(lock) == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(lock);
+    }
+}
+
+void SharedHeap::unlockHeap()
+{
+    pthread_mutex_unlock(lock);
+}
+
+void* SharedHeap::initialize(size_t size)
+{
+    if (heap != NULL || size == 0)
+    {
+        return NULL;
+    }
+    size_t arenas_num = (size + ALIGNMENT - 1) / ALIGNMENT;
+    size_t mapping_size = PAGE_SIZE + arenas_num * ALIGNMENT;
+    int fd = memfd_create("smalloc_shared", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    if (ftruncate(fd, mapping_size) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+    // reserve enough address space to place the arenas on an ALIGNMENT boundary
+    size_t reserved_size = mapping_size + ALIGNMENT;
+    void* reserved = mmap(NULL, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+    uintptr_t arenas_addr = ((uintptr_t)reserved + PAGE_SIZE + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1);
+    char* header = (char*)(arenas_addr - PAGE_SIZE);
+    if (mmap(header, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(reserved, reserved_size);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    if (header > (char*)reserved)
+    {
+        munmap(reserved, header - (char*)reserved);
+    }
+    char* reserved_end = (char*)reserved + reserved_size;
+    if (header + mapping_size < reserved_end)
+    {
+        munmap(header + mapping_size, reserved_end - (header + mapping_size));
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    lock = (pthread_mutex_t*)header;
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    heap = FreeList::createAt(header + ((sizeof(pthread_mutex_t) + 15) & ~(size_t)15));
+    heap->setTimed(false); // any process may use it, the histograms are per process
+    arenas = (char*)arenas_addr;
+    arenas_size = arenas_num * ALIGNMENT;
+    heap->addArena(arenas, arenas_size / MAX_BLOCK_SIZE);
+    return arenas;
+}
+
+void* SharedHeap::allocate(size_t size)
+{
+    if (heap == NULL || (size == 0) || (size > pow(10, 8)))
+    {
+        return NULL;
+    }
+    lockHeap();
+    void* result = allocateInternal(*heap, size, 0);
+    unlockHeap();
+    return result;
+}
+
+void SharedHeap::release(void* p)
+{
+    lockHeap();
+    releaseInternal(*heap, p);
+    unlockHeap();
+}
+
+bool SharedHeap::contains(void* p)
+{
+    return heap != NULL && (char*)p >= arenas && (char*)p < arenas + arenas_size;
+}
+
+char* SharedHeap::getArenas()
+{
+    return this->arenas;
+}
+
+// Must run before fork, children inherit the heap at the same address.
+void* sshared_init(size_t size)
+{
+    return SharedHeap::getInstance().initialize(size);
+}
+
+void* sshared_malloc(size_t size)
+{
+    return SharedHeap::getInstance().allocate(size);
+}
+
+void sshared_free(void* p)
+{
+    if (p == NULL || !SharedHeap::getInstance().contains(p))
+    {
+        return;
+    }
+    SharedHeap::getInstance().release(p);
+}
+
+// Offsets are position independent, e.g. for links stored inside shared blocks
+size_t sshared_offset(void* p)
+{
+    return (char*)p - SharedHeap::getInstance().getArenas();
+}
+
+void* sshared_ptr(size_t offset)
+{
+    return SharedHeap::getInstance().getArenas() + offset;
+}
+
+
+////////////////////////////////////Handles//////////////////////////////////
+
+// Relocatable allocations. The table maps a handle to the current address of its
+// block, and compaction may move any block that isn't pinned. The table belongs to
+// the default heap and is only touched under its lock.
+typedef struct HandleEntry {
+    void* ptr; // payload, NULL while the entry is free
+    uint32_t pins;
+    uint32_t next_free;
+} HandleEntry;
+
+class HandleTable {
+    HandleEntry* entries; // entry 0 is never used, 0 is the invalid handle
+    uint32_t capacity;
+    uint32_t free_head;
+    HandleTable() : entries(NULL), capacity(0), free_head(0) {}
+    bool grow();
+public:
+    static HandleTable& getInstance() // make HandleTable
+    {
+        static HandleTable instance; // Guaranteed to be destroyed.
+        // Instantiated on first use.
+        return instance;
+    }
+    uint32_t add(void* ptr);
+    void remove(uint32_t handle);
+    HandleEntry* get(uint32_t handle);
+};
+
+// the table lives in its own mapping, so it never competes with the blocks it tracks
+bool HandleTable::grow()
+{
+    uint32_t new_capacity = capacity ? capacity * 2 : PAGE_SIZE / sizeof(HandleEntry);
+    void* grown;
+    if (entries == NULL)
+    {
+        grown = mmap(NULL, new_capacity * sizeof(HandleEntry), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    else
+    {
+        grown = mremap(entries, capacity * sizeof(HandleEntry), new_capacity * sizeof(HandleEntry), MREMAP_MAYMOVE);
+    }
+    if (grown == MAP_FAILED)
+    {
+        return false;
+    }
+    entries = (HandleEntry*)grown;
+    for (uint32_t i = new_capacity - 1; i >= (capacity ? capacity : 1); i--)
+    {
+        entries[i].ptr = NULL;
+        entries[i].pins = 0;
+        entries[i].next_free = free_head;
+        free_head = i;
+    }
+    capacity = new_capacity;
+    return true;
+}
+
+uint32_t HandleTable::add(void* ptr)
+{
+    if (free_head == 0 && !grow())
+    {
+        return 0;
+    }
+    uint32_t handle = free_head;
+    free_head = entries[handle].next_free;
+    entries[handle].ptr = ptr;
+    entries[handle].pins = 0;
+    return handle;
+}
+
+void HandleTable::remove(uint32_t handle)
+{
+    entries[handle].ptr = NULL;
+    entries[handle].pins = 0;
+    entries[handle].next_free = free_head;
+    free_head = handle;
+}
+
+HandleEntry* HandleTable::get(uint32_t handle)
+{
+    if (handle == 0 || handle >= capacity || entries[handle].ptr == NULL)
+    {
+        return NULL;
+    }
+    return &entries[handle];
+}
+
+size_t shandle_alloc(size_t size)
+{
+    FreeList& heap = FreeList::getInstance();
+    heap.lockHeap();
+    void* allocated = allocateInternal(heap, size, 0);
+    uint32_t handle = allocated != NULL ? HandleTable::getInstance().add(allocated) : 0;
+    if (handle != 0)
+    {
+        ((MallocMetadata*)((char*)(allocated) - sizeof(MallocMetadata)))->handle = handle;
+    }
+    else
+    {
+        releaseInternal(heap, allocated);
+    }
+    StatsPage::getInstance().publish();
+    heap.unlockHeap();
+    return handle;
+}
+
+// the address stays valid until the matching unpin
+void* shandle_pin(size_t handle)
+{
+    FreeList& heap = FreeList::getInstance();
+    heap.lockHeap();
+    HandleEntry* entry = HandleTable::getInstance().get(handle);
+    void* ptr = NULL;
+    if (entry != NULL)
+    {
+        entry->pins++;
+        ptr = entry->ptr;
+    }
+    heap.unlockHeap();
+    return ptr;
+}
+
+void shandle_unpin(size_t handle)
+{
+    FreeList& heap = FreeList::getInstance();
+    heap.lockHeap();
+    HandleEntry* entry = HandleTable::getInstance().get(handle);
+    if (entry != NULL && entry->pins > 0)
+    {
+        entry->pins--;
+    }
+    heap.unlockHeap();
+}
+
+void shandle_free(size_t handle)
+{
+    FreeList& heap = FreeList::getInstance();
+    heap.lockHeap();
+    HandleEntry* entry = HandleTable::getInstance().get(handle);
+    if (entry != NULL)
+    {
+        releaseInternal(heap, entry->ptr); // drops the handle as well
+        StatsPage::getInstance().publish();
+    }
+    heap.unlockHeap();
+}
+
+// the block is being released, its handle goes back to the table's free list
+static void forgetHandle(MallocMetadata* block)
+{
+    HandleTable::getInstance().remove(block->handle);
+    block->handle = 0;
+}
+
+// srealloc moved a handle block, the handle follows it (pointers from shandle_pin don't)
+static void relocateHandle(MallocMetadata* block)
+{
+    HandleEntry* entry = HandleTable::getInstance().get(block->handle);
+    if (entry != NULL)
+    {
+        entry->ptr = (char*)(block) + sizeof(MallocMetadata);
+    }
+}
+
+// Moves an unpinned handle block into a free block of the same order at a lower
+// address, so its buddy can merge with the free block it leaves behind.
+static bool slideBlock(int order)
+{
+    FreeList& heap = FreeList::getInstance();
+    for (MallocMetadata* free_block = heap.getFreeList(order); free_block != NULL; free_block = free_block->next)
+    {
+        MallocMetadata* buddy = (MallocMetadata*)((size_t)(free_block) ^ free_block->size);
+        if (buddy->is_free || buddy->size != free_block->size || buddy->handle == 0)
+        {
+            continue;
+        }
+        HandleEntry* entry = HandleTable::getInstance().get(buddy->handle);
+        if (entry == NULL || entry->pins > 0)
+        {
+            continue;
+        }
+        // the list is sorted, so the lowest hole is at its head
+        MallocMetadata* hole = heap.getFreeList(order);
+        if (hole == free_block)
+        {
+            hole = hole->next;
+        }
+        if (hole == NULL || hole > buddy)
+        {
+            continue;
+        }
+        heap.removeBlock(hole, order);
+        hole->is_free = false;
+        hole->is_mmap = false;
+        hole->handle = buddy->handle;
+        hole->tag = buddy->tag;
+        memcpy((char*)(hole) + sizeof(MallocMetadata), (char*)(buddy) + sizeof(MallocMetadata),
+               buddy->size - sizeof(MallocMetadata));
+        entry->ptr = (char*)(hole) + sizeof(MallocMetadata);
+        buddy->handle = 0;
+        buddy->tag = 0;
+        heap.releaseBlock(buddy);
+        return true;
+    }
+    return false;
+}
+
+// Slides unpinned handle blocks down until every order below MAX_ORDER is as
+// merged as it can get, or until budget_us microseconds passed (0 means no limit).
+// Returns the number of moved blocks, call again to continue an interrupted pass.
+size_t shandle_compact(size_t budget_us)
+{
+    FreeList& heap = FreeList::getInstance();
+    heap.lockHeap();
+    bool initialized = heap.isInitialized();
+    heap.unlockHeap();
+    if (!initialized)
+    {
+        return 0;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t moved = 0;
+    for (int order = 0; order < MAX_ORDER; order++)
+    {
+        // one block per lock hold, other threads get in between the moves
+        while (true)
+        {
+            heap.lockHeap();
+            bool slid = slideBlock(order);
+            if (slid)
+            {
+                StatsPage::getInstance().publish();
+            }
+            heap.unlockHeap();
+            if (!slid)
+            {
+                break;
+            }
+            moved++;
+            if (budget_us == 0)
+            {
+                continue;
+            }
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            size_t elapsed_us = (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+            if (elapsed_us >= budget_us)
+            {
+                return moved;
+            }
+        }
+    }
+    return moved;
+}
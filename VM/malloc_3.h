@@ -0,0 +1,107 @@
+#ifndef MALLOC_3_H_
+#define MALLOC_3_H_
+
+#include <stddef.h>
+
+/*################################################################################################
+###########################################ALLOCATION#############################################
+##################################################################################################*/
+
+void* smalloc(size_t size);
+void* scalloc(size_t num, size_t size);
+void sfree(void* p);
+void* srealloc(void* oldp, size_t size);
+
+// flags for smalloc_ex and _set_arena_flags
+#define SMALLOC_PREFAULT 0x1 // fault the pages in now instead of on first touch
+#define SMALLOC_HUGEPAGE 0x2 // 2MB aligned mapping with transparent huge pages
+#define SMALLOC_ZERO 0x4 // zeroed memory, skipped where the kernel already zeroed it
+#define SMALLOC_NOCACHE_HINT 0x8 // the buffer is streamed, don't keep it hot in the caches
+
+void* smalloc_ex(size_t size, unsigned int flags);
+void _set_arena_flags(unsigned int flags); // only SMALLOC_PREFAULT and SMALLOC_HUGEPAGE apply
+
+// allocations accounted per tag, e.g. one tag per subsystem
+#define SMALLOC_MAX_TAGS 64 // tag 0 means untagged
+
+void* smalloc_tagged(size_t size, unsigned int tag_id);
+
+// buffers that grow in place inside a reservation of max_bytes, released with sfree
+void* sgrowable_create(size_t max_bytes);
+bool sgrowable_resize(void* buffer, size_t new_len);
+
+// relocatable allocations, 0 is the invalid handle
+size_t shandle_alloc(size_t size);
+void* shandle_pin(size_t handle);
+void shandle_unpin(size_t handle);
+void shandle_free(size_t handle);
+size_t shandle_compact(size_t budget_us);
+
+/*################################################################################################
+###########################################STATISTICS#############################################
+##################################################################################################*/
+
+size_t _num_free_blocks();
+size_t _num_free_bytes();
+size_t _num_allocated_blocks();
+size_t _num_allocated_bytes();
+size_t _num_meta_data_bytes();
+size_t _size_meta_data();
+
+size_t _mmap_threshold();
+void _set_mmap_threshold(size_t threshold);
+void _set_mmap_threshold_max(size_t threshold_max);
+
+bool _stats_publish(bool enable);
+
+enum AllocOperation { OP_SMALLOC, OP_SCALLOC, OP_SFREE, OP_SREALLOC, OPS_NUM };
+enum AllocPath { PATH_BUDDY, PATH_MMAP, PATH_SPLIT, PATH_MERGE, PATHS_NUM };
+
+void _histograms_enable(bool enable);
+void _histograms_reset();
+size_t _histogram_count(int op, int path, int bucket);
+size_t _histogram_percentile_ns(int op, int path, double percentile);
+void _histograms_print();
+
+typedef struct SmallocTagStats {
+    size_t live_bytes;
+    size_t live_blocks;
+    size_t allocations; // cumulative
+} SmallocTagStats;
+
+bool _tag_stats(unsigned int tag_id, SmallocTagStats* stats);
+void _tags_print();
+
+/*################################################################################################
+###########################################SHARED_HEAP############################################
+##################################################################################################*/
+
+void* sshared_init(size_t size);
+void* sshared_malloc(size_t size);
+void sshared_free(void* p);
+size_t sshared_offset(void* p);
+void* sshared_ptr(size_t offset);
+
+/*################################################################################################
+#########################################HEAP_INSTANCES###########################################
+##################################################################################################*/
+
+// independent heaps over caller memory, the smalloc family works on the default heap
+struct sheap;
+
+sheap* sheap_create(void* base, size_t len);
+void* sheap_malloc(sheap* heap, size_t size);
+void sheap_free(sheap* heap, void* p);
+void sheap_destroy(sheap* heap);
+sheap* sheap_default();
+
+// free blocks to prepare per order, order i holds blocks of 128 << i bytes (metadata included)
+#define SMALLOC_ORDERS 11
+bool sheap_reserve(sheap* heap, const size_t* order_counts);
+
+size_t sheap_num_free_blocks(sheap* heap);
+size_t sheap_num_free_bytes(sheap* heap);
+size_t sheap_num_allocated_blocks(sheap* heap);
+size_t sheap_num_allocated_bytes(sheap* heap);
+
+#endif //MALLOC_3_H_
@@ -0,0 +1,64 @@
+#ifndef MALLOC_STATS_H_
+#define MALLOC_STATS_H_
+
+#include <stdint.h>
+#include <sched.h>
+
+// Layout of the page malloc_3 publishes under /dev/shm/smalloc_stats.<pid>,
+// shared by the allocator (writer) and smalloc_stat (reader).
+
+#define MALLOC_STATS_DIR "/dev/shm"
+#define MALLOC_STATS_PREFIX "smalloc_stats."
+#define MALLOC_STATS_MAGIC 0x3153544154534d53ULL // "SMSTATS1"
+#define MALLOC_STATS_ORDERS 11 // MAX_ORDER + 1
+#define MALLOC_STATS_READ_RETRIES 1000 // a writer that died mid-update leaves the sequence odd
+
+typedef struct MallocStats {
+    uint64_t magic;
+    uint32_t sequence; // seqlock, odd while the allocator is writing
+    int32_t pid;
+    uint64_t allocated_blocks;
+    uint64_t allocated_bytes;
+    uint64_t free_blocks;
+    uint64_t free_bytes;
+    uint64_t free_blocks_per_order[MALLOC_STATS_ORDERS];
+    uint64_t mmap_blocks;
+    uint64_t mmap_bytes;
+    uint64_t max_order_free_bytes; // free bytes that can still serve a MAX_ORDER request
+    uint32_t fragmentation_permille; // 1000 * (1 - max_order_free_bytes / free_bytes)
+} MallocStats;
+
+static inline void mallocStatsWriteBegin(MallocStats* stats)
+{
+    __atomic_store_n(&stats->sequence, stats->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void mallocStatsWriteEnd(MallocStats* stats)
+{
+    __atomic_store_n(&stats->sequence, stats->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Copies a consistent snapshot, retrying while the writer is in the middle of an
+// update. Returns false when no consistent copy came out of the retries.
+static inline bool mallocStatsRead(const MallocStats* stats, MallocStats* snapshot)
+{
+    for (int i = 0; i < MALLOC_STATS_READ_RETRIES; i++)
+    {
+        uint32_t before = __atomic_load_n(&stats->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        __builtin_memcpy(snapshot, (const void*)stats, sizeof(MallocStats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&stats->sequence, __ATOMIC_RELAXED) == before)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif //MALLOC_STATS_H_
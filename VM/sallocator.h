@@ -0,0 +1,83 @@
+#ifndef SALLOCATOR_H_
+#define SALLOCATOR_H_
+
+#include <cstddef>
+#include <new>
+#include "malloc_3.h"
+
+// Standard allocator over the malloc_3 heap, for std containers and strings:
+//   std::vector<int, SAllocator<int> > v;
+// Allocates from the default heap unless given a heap instance, e.g. to keep the
+// memory of one subsystem apart: SAllocator<int>(sheap_create(base, len)).
+// Allocators compare equal when they share the heap.
+
+// number of allocations made through any SAllocator, for per-command measurements
+inline size_t& sallocatorAllocations()
+{
+    static size_t allocations = 0;
+    return allocations;
+}
+
+template <class T>
+class SAllocator {
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    template <class U>
+    struct rebind {
+        typedef SAllocator<U> other;
+    };
+
+    SAllocator() noexcept : heap(sheap_default()) {}
+    explicit SAllocator(sheap* instance) noexcept : heap(instance) {}
+    template <class U>
+    SAllocator(const SAllocator<U>& other) noexcept : heap(other.getHeap()) {}
+
+    sheap* getHeap() const noexcept
+    {
+        return heap;
+    }
+
+    T* allocate(std::size_t n)
+    {
+        if (n > std::size_t(-1) / sizeof(T))
+        {
+            throw std::bad_alloc();
+        }
+        // smalloc(0) fails, an empty allocation still gets a block of its own
+        void* allocated = sheap_malloc(heap, n == 0 ? 1 : n * sizeof(T));
+        if (allocated == NULL)
+        {
+            throw std::bad_alloc();
+        }
+        sallocatorAllocations()++;
+        return static_cast<T*>(allocated);
+    }
+
+    void deallocate(T* p, std::size_t) noexcept
+    {
+        sheap_free(heap, p);
+    }
+
+private:
+    sheap* heap;
+};
+
+template <class T, class U>
+bool operator==(const SAllocator<T>& a, const SAllocator<U>& b) noexcept
+{
+    return a.getHeap() == b.getHeap();
+}
+
+template <class T, class U>
+bool operator!=(const SAllocator<T>& a, const SAllocator<U>& b) noexcept
+{
+    return a.getHeap() != b.getHeap();
+}
+
+#endif //SALLOCATOR_H_
@@ -0,0 +1,136 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "malloc_stats.h"
+
+// Reads the stats pages published by malloc_3 and prints one line per process
+// plus a total. Usage: smalloc_stat [pid...], no pids means every page in /dev/shm.
+
+enum StatsState { STATS_OK, STATS_MISSING, STATS_STALE, STATS_TORN };
+
+static StatsState readStats(int pid, MallocStats* snapshot)
+{
+    // a page left behind by a process that died without cleaning up, maybe mid-update
+    if (kill(pid, 0) == -1 && errno == ESRCH)
+    {
+        return STATS_STALE;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s%d", MALLOC_STATS_DIR, MALLOC_STATS_PREFIX, pid);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return STATS_MISSING;
+    }
+    void* page = mmap(NULL, sizeof(MallocStats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED)
+    {
+        return STATS_MISSING;
+    }
+    bool consistent = mallocStatsRead((const MallocStats*)page, snapshot);
+    munmap(page, sizeof(MallocStats));
+    if (!consistent)
+    {
+        return STATS_TORN;
+    }
+    return snapshot->magic == MALLOC_STATS_MAGIC ? STATS_OK : STATS_MISSING;
+}
+
+static void printStats(const char* name, const MallocStats* stats)
+{
+    printf("%-10s %10llu %14llu %10llu %14llu %8llu %14llu %7.1f%%  ", name,
+           (unsigned long long)stats->allocated_blocks, (unsigned long long)stats->allocated_bytes,
+           (unsigned long long)stats->free_blocks, (unsigned long long)stats->free_bytes,
+           (unsigned long long)stats->mmap_blocks, (unsigned long long)stats->mmap_bytes,
+           stats->fragmentation_permille / 10.0);
+    for (int i = 0; i < MALLOC_STATS_ORDERS; i++)
+    {
+        printf("%llu%c", (unsigned long long)stats->free_blocks_per_order[i], i + 1 < MALLOC_STATS_ORDERS ? '/' : '\n');
+    }
+}
+
+static void addStats(MallocStats* total, const MallocStats* stats)
+{
+    total->allocated_blocks += stats->allocated_blocks;
+    total->allocated_bytes += stats->allocated_bytes;
+    total->free_blocks += stats->free_blocks;
+    total->free_bytes += stats->free_bytes;
+    total->mmap_blocks += stats->mmap_blocks;
+    total->mmap_bytes += stats->mmap_bytes;
+    for (int i = 0; i < MALLOC_STATS_ORDERS; i++)
+    {
+        total->free_blocks_per_order[i] += stats->free_blocks_per_order[i];
+    }
+    total->max_order_free_bytes += stats->max_order_free_bytes;
+}
+
+static void reportPid(int pid, MallocStats* total, int* processes)
+{
+    MallocStats stats;
+    StatsState state = readStats(pid, &stats);
+    if (state == STATS_STALE || state == STATS_TORN)
+    {
+        // left out of the total
+        printf("%-10d %s\n", pid, state == STATS_STALE ? "stale (process is gone)" : "torn (writer stuck mid-update)");
+        return;
+    }
+    if (state != STATS_OK)
+    {
+        return;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "%d", pid);
+    printStats(name, &stats);
+    addStats(total, &stats);
+    (*processes)++;
+}
+
+int main(int argc, char* argv[])
+{
+    MallocStats total;
+    memset(&total, 0, sizeof(total));
+    int processes = 0;
+    printf("%-10s %10s %14s %10s %14s %8s %14s %8s  %s\n", "PID", "BLOCKS", "BYTES", "FREE_BLK",
+           "FREE_BYTES", "MMAP_BLK", "MMAP_BYTES", "FRAG", "FREE_PER_ORDER(0..10)");
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            reportPid(atoi(argv[i]), &total, &processes);
+        }
+    }
+    else
+    {
+        DIR* dir = opendir(MALLOC_STATS_DIR);
+        if (dir == NULL)
+        {
+            perror("smalloc_stat: opendir failed");
+            return 1;
+        }
+        size_t prefix_len = strlen(MALLOC_STATS_PREFIX);
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strncmp(entry->d_name, MALLOC_STATS_PREFIX, prefix_len) == 0)
+            {
+                reportPid(atoi(entry->d_name + prefix_len), &total, &processes);
+            }
+        }
+        closedir(dir);
+    }
+    if (total.free_bytes > 0)
+    {
+        total.fragmentation_permille = (uint32_t)(1000 - total.max_order_free_bytes * 1000 / total.free_bytes);
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "TOTAL(%d)", processes);
+    printStats(name, &total);
+    return 0;
+}
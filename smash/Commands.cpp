@@ -2,10 +2,10 @@
 #include <string.h>
 #include <iostream>
 #include <vector>
-#include <sstream>
 #include <sys/wait.h>
 #include <iomanip>
 #include "Commands.h"
+#include "signals.h"
 #include <regex>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -16,12 +16,39 @@
 #include <grp.h>
 #include <chrono>
 #include <sys/syscall.h>
+#include <glob.h>
+#include <memory>
 
 
 using namespace std;
 
+#ifdef SMASH_USE_SALLOCATOR
+// the temporary strings and vectors, the commands themselves, counted with the rest
+void* operator new(size_t size)
+{
+  void* allocated = SMASH_MALLOC(size == 0 ? 1 : size);
+  if (allocated == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return allocated;
+}
+
+void operator delete(void* p) noexcept
+{
+  SMASH_FREE(p);
+}
+#endif
+
 const std::string WHITESPACE = " \n\r\t\f\v";
 
+// flags of the built-in registry, see BUILT_INS
+#define BUILTIN_RAW_LINE 0x1 // takes the rest of the line as is, | and > included (watch)
+#define BUILTIN_IN_PARENT 0x2 // changes smash itself, so it never runs in a forked copy
+#define BUILTIN_REDIRECTABLE 0x4 // writes to stdout, > and | take its output
+
+static unsigned int builtInFlags(const CommandNode& node);
+
 #if 0
 #define FUNC_ENTRY()  \
   cout << __PRETTY_FUNCTION__ << " --> " << endl;
@@ -47,64 +74,27 @@ string _trim(const std::string &s) {
     return _rtrim(_ltrim(s));
 }
 
-int _parseCommandLine(const char *cmd_line, char **args) {
-    FUNC_ENTRY()
-    int i = 0;
-    std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;) {
-        args[i] = (char *) malloc(s.length() + 1);
-        memset(args[i], 0, s.length() + 1);
-        strcpy(args[i], s.c_str());
-        args[++i] = NULL;
-    }
-    return i;
-
-    FUNC_EXIT()
-}
-
-bool _isBackgroundComamnd(const char *cmd_line) {
-    const string str(cmd_line);
-    return str[str.find_last_not_of(WHITESPACE)] == '&';
-}
-
-void _removeBackgroundSign(char *cmd_line) {
-    const string str(cmd_line);
-    // find last character other than spaces
-    unsigned int idx = str.find_last_not_of(WHITESPACE);
-    // if all characters are spaces then return
-    if (idx == string::npos) {
-        return;
-    }
-    // if the command line does not end with & then return
-    if (cmd_line[idx] != '&') {
-        return;
-    }
-    // replace the & (background sign) with space and then remove all tailing spaces.
-    cmd_line[idx] = ' ';
-    // truncate the command line string up to the last non-space character
-    cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
-}
-
-
 //////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////COMMAND//////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 
-Command::Command(const char *cmd_line)
+// the words, text and background sign come from the parser, nothing is copied
+Command::Command(const CommandNode& node)
 {
-  this->cmd_line = new char[strlen(cmd_line) + 1];
-  strcpy(this->cmd_line, cmd_line);
-  this->args_num = _parseCommandLine(cmd_line,this->args);
-  this->isBackground = _isBackgroundComamnd(cmd_line);
+  this->cmd_line = node.text;
+  this->args = node.args;
+  this->args_num = node.args_num;
+  this->isBackground = node.background;
 }
 
-Command::~Command()
+Command::Command(const LineNode& line)
 {
-  for(int i = 0; i < COMMAND_MAX_ARGS + 1; ++i)
-  {
-    free(this->args[i]);
-  }
+  static char* no_args[] = {nullptr};
+  this->cmd_line = line.text;
+  this->args = no_args;
+  this->args_num = 0;
+  this->isBackground = line.background;
 }
 
 char* Command::getCmdLine()
@@ -118,13 +108,12 @@ char* Command::getCmdLine()
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 
-BuiltInCommand::BuiltInCommand(const char *cmd_line,bool remove_bachground_sing) : Command(cmd_line)
+BuiltInCommand::BuiltInCommand(const CommandNode& node,bool remove_bachground_sing) : Command(node)
 {
-  if (remove_bachground_sing && this->isBackground)
+  if (remove_bachground_sing)
   {
-    _removeBackgroundSign(this->cmd_line);
+    this->cmd_line = node.bare_text;
   }
-  this->args_num = _parseCommandLine(this->cmd_line,this->args);
 }
 
 
@@ -133,14 +122,15 @@ BuiltInCommand::BuiltInCommand(const char *cmd_line,bool remove_bachground_sing)
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 
-ExternalCommand::ExternalCommand(const char *cmd_line,std::string original_cmd_line , bool isAlias)
-                                 : Command(cmd_line),original_cmd_line(original_cmd_line),isAlias(isAlias) {}
+ExternalCommand::ExternalCommand(const CommandNode& node,std::string original_cmd_line , bool isAlias)
+                                 : Command(node),original_cmd_line(original_cmd_line),isAlias(isAlias),
+                                   bare_cmd_line(node.bare_text),use_bash(false) {}
 
 bool isComplex(std::string string)
 {
   for(auto & ch : string)
   {
-    if (ch  == '*' || ch == '?')
+    if (ch  == '*' || ch == '?' || ch == '[')
     {
       return true;
     }
@@ -148,6 +138,116 @@ bool isComplex(std::string string)
   return false;
 }
 
+// quoting, variables, substitutions and command lists still need a real shell
+bool needsBash(std::string string)
+{
+  return string.find_first_of("'\"`$\\;(){}") != std::string::npos;
+}
+
+// the words to exec: no background sign, wildcards expanded by glob(3), sorted,
+// words without a match kept as they are (like bash). The path is resolved here, in
+// smash itself, so the lookup stays in its hash table whoever runs the command.
+void ExternalCommand::prepareArgs()
+{
+  bool is_complex = isComplex(this->bare_cmd_line);
+  this->use_bash = is_complex && needsBash(this->bare_cmd_line);
+  this->bash_args[0] = "/bin/bash";
+  this->bash_args[1] = "-c";
+  this->bash_args[2] = this->bare_cmd_line;
+  this->bash_args[3] = nullptr;
+  this->expanded_args.clear();
+  for (int i = 0; i < this->args_num; i++)
+  {
+    glob_t matches;
+    bool pattern = is_complex && strpbrk(this->args[i],"*?[") != nullptr;
+    if (!pattern || glob(this->args[i],GLOB_NOCHECK,nullptr,&matches) != 0)
+    {
+      this->expanded_args.push_back(this->args[i]);
+      continue;
+    }
+    for (size_t j = 0; j < matches.gl_pathc; j++)
+    {
+      this->expanded_args.push_back(matches.gl_pathv[j]);
+    }
+    globfree(&matches);
+  }
+  this->exec_args.clear();
+  for (std::string& arg : this->expanded_args)
+  {
+    this->exec_args.push_back((char*)arg.c_str());
+  }
+  this->exec_args.push_back(nullptr);
+  bool lookup = !this->use_bash && this->exec_args[0] != nullptr;
+  this->exec_path = lookup ? SmallShell::getInstance().findCommand(this->exec_args[0]) : "";
+}
+
+// replaces the calling process, the caller already set up its fds and process group
+// and called prepareArgs before forking
+void ExternalCommand::exec()
+{
+  if (this->use_bash)
+  {
+    if (execv(bash_args[0],(char * *)bash_args) == -1)
+    {
+      perror("smash error: execv failed");
+      exit(1);
+    }
+  }
+  else
+  {
+    if (this->exec_path.empty())
+    {
+      errno = ENOENT;
+      perror("smash error: execvp failed");
+      exit(1);
+    }
+    if (execv(this->exec_path.c_str(),this->exec_args.data()) == -1)
+    {
+      perror("smash error: execvp failed");
+      exit(1);
+    }
+  }
+}
+
+// Starts the command straight from smash with the given fd setup, without a forked
+// copy of the shell in between (glibc uses a CLONE_VM | CLONE_VFORK child, so no page
+// tables are copied). process_group is passed to setpgid, -1 keeps the caller's group.
+// Returns the pid, or -1 after reporting the error.
+pid_t ExternalCommand::spawn(const posix_spawn_file_actions_t* file_actions, pid_t process_group)
+{
+  prepareArgs();
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  // smash blocks the signals its event loop reads, the command starts with them unblocked
+  short flags = POSIX_SPAWN_SETSIGMASK;
+  posix_spawnattr_setsigmask(&attributes, EventLoop::getInstance().childMask());
+  if (process_group >= 0)
+  {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attributes, process_group);
+  }
+  posix_spawnattr_setflags(&attributes, flags);
+  pid_t pid;
+  int error;
+  if (this->use_bash)
+  {
+    error = posix_spawn(&pid, bash_args[0], file_actions, &attributes, (char * *)bash_args, environ);
+  }
+  else
+  {
+    error = this->exec_path.empty() ? ENOENT : posix_spawn(&pid, this->exec_path.c_str(), file_actions, &attributes,
+                                                           this->exec_args.data(), environ);
+  }
+  posix_spawnattr_destroy(&attributes);
+  if (error != 0)
+  {
+    errno = error;
+    perror(this->use_bash ? "smash error: execv failed" : "smash error: execvp failed");
+    return -1;
+  }
+  return pid;
+}
+
 void ExternalCommand::execute()
 {
   std::string alias_cmd_line_orignal = this->cmd_line;
@@ -155,6 +255,8 @@ void ExternalCommand::execute()
   {
     alias_cmd_line_orignal = this->original_cmd_line;
   }
+#ifdef SMASH_FORK_EXEC
+  prepareArgs();
   pid_t pid = fork();
   if (pid < 0)
   {
@@ -163,45 +265,34 @@ void ExternalCommand::execute()
   }
   else if (pid == 0)
   {
-    std::string copy = this->cmd_line;
-    _removeBackgroundSign((char*)copy.c_str());
-    copy = _trim(copy);
-    this->cmd_line = new char[string(copy).length()+1];
-    strcpy(this->cmd_line,copy.c_str());
-    this->args_num = _parseCommandLine(this->cmd_line,this->args);
-    setpgrp();
-    if (isComplex(this->cmd_line))
+    EventLoop::getInstance().forkedChild();
+    // stages of a pipeline stay in the pipeline's process group
+    if (getppid() == SmallShell::getInstance().getSmashPid())
     {
-      const char *argp[] = {"/bin/bash","-c",this->cmd_line,nullptr};
-      if (execv(argp[0],(char * *)argp) == -1)
-      {
-        perror("smash error: execv failed");
-        exit(1);
-      }
-    }
-    else
-    {
-      if (execvp(this->args[0],this->args) == -1)
-      {
-        perror("smash error: execvp failed");
-        exit(1);
-      }
+      setpgrp();
     }
+    exec();
   }
-  else if (pid > 0)
+#else
+  // commands of smash itself lead their own process group, nested ones (built-in
+  // pipeline stages, watch) stay in the group of the process running them
+  pid_t pid = spawn(nullptr, getpid() == SmallShell::getInstance().getSmashPid() ? 0 : -1);
+  if (pid == -1)
   {
-    if (this->isBackground)
-    {
-      JobsList::getInstance().addJob(alias_cmd_line_orignal,pid);
-    }
-    else
+    return;
+  }
+#endif
+  if (this->isBackground)
+  {
+    JobsList::getInstance().addJob(alias_cmd_line_orignal,pid);
+  }
+  else
+  {
+    int job_id = JobsList::getInstance().addJob(alias_cmd_line_orignal,pid,false);
+    if (!JobsList::getInstance().waitForJob(job_id))
     {
-      JobsList::getInstance().addJob(alias_cmd_line_orignal,pid,false);
-      if (waitpid(pid, nullptr,0) == -1)
-      {
-        perror("smash error: waitpid failed");
-        return;
-      }
+      perror("smash error: waitpid failed");
+      return;
     }
   }
 }
@@ -212,27 +303,91 @@ void ExternalCommand::execute()
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 
-RedirectionCommand::RedirectionCommand(const char *cmd_line) : Command(cmd_line) {}
+RedirectionCommand::RedirectionCommand(const LineNode& line) : Command(line), line(line) {}
+
+// Runs a built-in in smash itself with fd (stdout or stderr) moved onto target until
+// it returns, target -1 leaves fd alone.
+static void executeInParent(Command* cmd, int fd, int target)
+{
+  int saved = -1;
+  if (target != -1)
+  {
+    cout.flush();
+    cerr.flush();
+    saved = dup(fd);
+    if (saved == -1 || dup2(target,fd) == -1)
+    {
+      perror("smash error: dup failed");
+      if (saved != -1)
+      {
+        close(saved);
+      }
+      return;
+    }
+  }
+  cmd->execute();
+  if (saved != -1)
+  {
+    cout.flush();
+    cerr.flush();
+    dup2(saved,fd);
+    close(saved);
+  }
+}
 
 void RedirectionCommand::execute()
 {
-  std::regex pattern(R"(\S+\s*>>\s*\S+)");
-  bool append = false;
-  std::string str = this->cmd_line;
-  size_t start = str.find_first_of(">");
-  string cmd_line_1 = str.substr(0,start);
-  size_t end = start;
-  if (std::regex_search(str,pattern))
+  bool append = this->line.append;
+  std::string path = this->line.redirect_path;
+  // the rest of the line runs in the foreground with stdout on the file
+  LineNode inner = this->line;
+  inner.redirect_path = nullptr;
+  inner.background = false;
+  // owned here on every path, the forked child exits without returning
+  std::unique_ptr<Command> cmd;
+  if (inner.stages_num > 1)
   {
-    append = true;
-    end++;
+    cmd.reset(new PipeCommand(inner));
   }
-  string path = _trim(str.substr(end+1));
-  if (this->isBackground)
+  else
+  {
+    cmd.reset(SmallShell::getInstance().CreateCommand(inner.stages[0]));
+  }
+  if (cmd == nullptr)
   {
-    path = _trim(path.substr(0,path.length()-1));
+    return;
+  }
+  unsigned int flags = inner.stages_num == 1 ? builtInFlags(inner.stages[0]) : 0;
+  ExternalCommand* external = flags == 0 ? dynamic_cast<ExternalCommand*>(cmd.get()) : nullptr;
+  if (external != nullptr || (flags & BUILTIN_IN_PARENT))
+  {
+    // open here, no shell copy in between
+    int fd = open(path.c_str(),O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC),0666);
+    if (fd == -1)
+    {
+      perror("smash error: open failed");
+      return;
+    }
+    if (external == nullptr)
+    {
+      // the file is created either way, only output that goes to stdout is moved
+      executeInParent(cmd.get(),1,(flags & BUILTIN_REDIRECTABLE) ? fd : -1);
+      close(fd);
+      return;
+    }
+    // spawned with the file dup'ed onto stdout
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_adddup2(&file_actions,fd,1);
+    pid_t pid = external->spawn(&file_actions,0);
+    posix_spawn_file_actions_destroy(&file_actions);
+    close(fd);
+    if (pid > 0 && !EventLoop::getInstance().waitForProcess(pid))
+    {
+      perror("smash error: waitpid failed");
+    }
+    return;
   }
-  Command * cmd = SmallShell::getInstance().CreateCommand(cmd_line_1.c_str());
   pid_t pid = fork();
   if (pid == -1)
   {
@@ -241,6 +396,7 @@ void RedirectionCommand::execute()
   }
   else if (pid == 0)
   {
+    EventLoop::getInstance().forkedChild();
     setpgrp();
     int fd;
     if (!append) // > symbol
@@ -271,7 +427,7 @@ void RedirectionCommand::execute()
   }
   else if (pid > 0)
   {
-    if(waitpid(pid,nullptr,0) == -1)
+    if(!EventLoop::getInstance().waitForProcess(pid))
     {
       perror("smash error: waitpid failed");
       return;
@@ -284,7 +440,7 @@ void RedirectionCommand::execute()
 ////////////////////////////////////////LIST_DIR_COMMAND/////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
 
-ListDirCommand::ListDirCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+ListDirCommand::ListDirCommand(const CommandNode& node) : BuiltInCommand(node) {}
 
 void ListDirCommand::execute()
 {
@@ -295,8 +451,8 @@ void ListDirCommand::execute()
   }
   else 
   {
-    char buffer[COMMAND_MAX_LENGTH];
-    if(getcwd(buffer,COMMAND_MAX_LENGTH) == nullptr)
+    char buffer[SMASH_BUFFER_SIZE];
+    if(getcwd(buffer,sizeof(buffer)) == nullptr)
     {      
       perror("smash error: getcwd failed");
       return;
@@ -388,7 +544,7 @@ void ListDirCommand::execute()
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 
-GetUserCommand::GetUserCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+GetUserCommand::GetUserCommand(const CommandNode& node) : BuiltInCommand(node) {}
 
 void GetUserCommand::execute()
 {
@@ -414,7 +570,7 @@ void GetUserCommand::execute()
     }
     uid_t uid;
     gid_t gid;
-    char buffer[COMMAND_MAX_LENGTH];
+    char buffer[SMASH_BUFFER_SIZE];
     int bytes_num;
     string file;
     bytes_num = read(fd,buffer,sizeof(buffer)-1);
@@ -467,7 +623,7 @@ void GetUserCommand::execute()
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 
-WatchCommand::WatchCommand(const char *cmd_line) : Command(cmd_line) {}
+WatchCommand::WatchCommand(const CommandNode& node) : Command(node) {}
 
 bool isNumber(std::string string)
 {
@@ -512,10 +668,6 @@ void WatchCommand::execute()
       cmd_line_1 += args[i];
       cmd_line_1 += " ";
     }
-    if (this->isBackground)
-    {
-      _removeBackgroundSign((char*)cmd_line_1.c_str());
-    } 
     Command* command = SmallShell::getInstance().CreateCommand(cmd_line_1.c_str());
     Command* sleep_command = SmallShell::getInstance().CreateCommand(cmd_line_2.c_str());
     Command* clear_command = SmallShell::getInstance().CreateCommand("clear");
@@ -527,6 +679,7 @@ void WatchCommand::execute()
     }
     else if (pid == 0)
     {
+      EventLoop::getInstance().forkedChild();
       setpgrp();
       if (this->isBackground)
       {
@@ -566,8 +719,8 @@ void WatchCommand::execute()
       }
       else
       {
-        JobsList::getInstance().addJob(this->cmd_line,pid,false);
-        if (waitpid(pid, nullptr,0) == -1)
+        int job_id = JobsList::getInstance().addJob(this->cmd_line,pid,false);
+        if (!JobsList::getInstance().waitForJob(job_id))
         {
           perror("smash error: waitpid failed");
           return;
@@ -583,106 +736,249 @@ void WatchCommand::execute()
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 
-PipeCommand::PipeCommand(const char *cmd_line) : Command(cmd_line) {}
+PipeCommand::PipeCommand(const LineNode& line) : Command(line), stages(line.stages),
+                                                  stderr_edges(line.stderr_edges), stages_num(line.stages_num) {}
 
-void PipeCommand::execute()
+void closePipes(std::vector<int>& pipe_fds)
 {
-  std::regex pattern(R"(\|\s*&|\|&)");
-  bool regular_pipe = true;
-  string tmp = this->cmd_line;
-  size_t start = tmp.find_first_of("|");
-  string cmd_line_1 = tmp.substr(0,start);
-  if (std::regex_search(tmp,pattern))
+  for (int fd : pipe_fds)
   {
-    regular_pipe = false;
-    start++;
+    close(fd);
   }
-  string cmd_line_2 = tmp.substr(start+1);
-  Command * command_1 = SmallShell::getInstance().CreateCommand(cmd_line_1.c_str());
-  Command * command_2 = SmallShell::getInstance().CreateCommand(cmd_line_2.c_str());
-  int my_pipe[2];
-  pipe(my_pipe);
-  pid_t pid_1 = fork();
-  if (pid_1 < 0)
-  {
-    perror("smash error: fork failed");
-    return;
-  }
-  else if (pid_1 == 0)
+}
+
+// Every stage gets its own child, all of them in one process group led by the first
+// stage, with one pipe per edge (|& included, its writer streams into the reader).
+// The pipeline is a single job, waited for until none of its members is left.
+void PipeCommand::execute()
+{
+  size_t stages_num = this->stages_num;
+  std::vector<Command*> commands;
+  for (size_t i = 0; i < stages_num; i++)
   {
-    setpgrp();
-    int fd_stdout_or_stderr = 1; 
-    if (!regular_pipe)
+    Command* command = SmallShell::getInstance().CreateCommand(stages[i]);
+    if (command == nullptr)
     {
-      fd_stdout_or_stderr = 2;
+      for (Command* created : commands)
+      {
+        delete created;
+      }
+      return;
     }
-    if (dup2(my_pipe[1],fd_stdout_or_stderr) == -1)
+    commands.push_back(command);
+  }
+  // SMASH_PIPE_SIZE enlarges every pipe, for high-volume pipelines (capped by /proc/sys/fs/pipe-max-size)
+  const char* pipe_size_env = getenv("SMASH_PIPE_SIZE");
+  int pipe_size = pipe_size_env ? atoi(pipe_size_env) : 0;
+  std::vector<int> pipe_fds;
+  for (size_t i = 0; i + 1 < stages_num; i++)
+  {
+    int my_pipe[2];
+    if (pipe2(my_pipe, O_CLOEXEC) == -1)
     {
-      perror("smash error: dup failed");
-      exit(1);
+      perror("smash error: pipe failed");
+      closePipes(pipe_fds);
+      return;
     }
-    if (close(my_pipe[0]) == -1 || close(my_pipe[1]) == -1)
+    if (pipe_size > 0 && fcntl(my_pipe[1], F_SETPIPE_SZ, pipe_size) == -1)
     {
-      perror("smash error: close failed");
-      exit(1);
+      perror("smash error: fcntl failed");
     }
-    command_1->execute();
-    exit(0);
+    pipe_fds.push_back(my_pipe[0]);
+    pipe_fds.push_back(my_pipe[1]);
   }
-  else if (pid_1 > 0)
+  std::vector<pid_t> pids;
+  std::vector<size_t> in_parent; // stages that run in smash once the others started
+  pid_t leader = 0;
+  for (size_t i = 0; i < stages_num; i++)
   {
-    if (!regular_pipe)
+    unsigned int flags = builtInFlags(stages[i]);
+    if (flags & BUILTIN_IN_PARENT)
     {
-      if (waitpid(pid_1,nullptr,0) == -1)
+      in_parent.push_back(i);
+      continue;
+    }
+    ExternalCommand* external = flags == 0 ? dynamic_cast<ExternalCommand*>(commands[i]) : nullptr;
+    pid_t pid;
+    if (external != nullptr)
+    {
+      // the pipes are close-on-exec, only the dup'ed ends survive in the stage
+      posix_spawn_file_actions_t file_actions;
+      posix_spawn_file_actions_init(&file_actions);
+      if (i > 0)
       {
-        perror("smash error: waitpid failed");
-        return;      
+        posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[2 * (i - 1)], 0);
+      }
+      if (i + 1 < stages_num)
+      {
+        posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[2 * i + 1], stderr_edges[i] ? 2 : 1);
+      }
+      pid = external->spawn(&file_actions, leader);
+      posix_spawn_file_actions_destroy(&file_actions);
+      if (pid == -1)
+      {
+        continue; // like a stage that failed its exec, the others still run
       }
     }
-    pid_t pid_2 = fork();
-    if (pid_2 < 0)
+    else if ((pid = fork()) < 0)
     {
       perror("smash error: fork failed");
-      return;
+      break;
     }
-    else if (pid_2 == 0)
+    else if (pid == 0)
     {
-      setpgrp();
-      if (dup2(my_pipe[0],0) == -1)
+      EventLoop::getInstance().forkedChild();
+      setpgid(0, leader);
+      if (i > 0 && dup2(pipe_fds[2 * (i - 1)], 0) == -1)
       {
         perror("smash error: dup failed");
         exit(1);
       }
-      if (close(my_pipe[0]) == -1 || close(my_pipe[1]) == -1)
+      if (i + 1 < stages_num && dup2(pipe_fds[2 * i + 1], stderr_edges[i] ? 2 : 1) == -1)
       {
-        perror("smash error: close failed");
+        perror("smash error: dup failed");
         exit(1);
       }
-      command_2->execute();
+      closePipes(pipe_fds);
+      commands[i]->execute();
       exit(0);
     }
-    else if (pid_2 > 0)
+    // set on both sides, whichever runs first
+    setpgid(pid, leader ? leader : pid);
+    if (!leader)
     {
-      if (close(my_pipe[0]) == -1 || close(my_pipe[1]) == -1)
-      {
-        perror("smash error: close failed");
-        return;
-      }
-      if (regular_pipe)
-      {
-        if (waitpid(pid_1,nullptr,WNOHANG) == -1)
-        {
-          perror("smash error: waitpid failed");
-          return;      
-        }      
-      }
-      if (waitpid(pid_2,nullptr,0) == -1)
-      {
-        perror("smash error: waitpid failed");
-        return;      
-      }
+      leader = pid;
+    }
+    pids.push_back(pid);
+  }
+  for (size_t i : in_parent)
+  {
+    // the readers already run, so the output can't fill the pipe for good
+    if (i + 1 < stages_num && (builtInFlags(stages[i]) & BUILTIN_REDIRECTABLE))
+    {
+      executeInParent(commands[i],stderr_edges[i] ? 2 : 1,pipe_fds[2 * i + 1]);
+    }
+    else
+    {
+      executeInParent(commands[i],1,-1);
+    }
+  }
+  closePipes(pipe_fds);
+  for (Command* command : commands)
+  {
+    delete command;
+  }
+  if (pids.empty())
+  {
+    return;
+  }
+  if (this->isBackground)
+  {
+    JobsList::getInstance().addJob(this->cmd_line,leader,true,true);
+    return;
+  }
+  int job_id = JobsList::getInstance().addJob(this->cmd_line,leader,false,true);
+  if (!JobsList::getInstance().waitForJob(job_id))
+  {
+    perror("smash error: waitpid failed");
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////BUILT_IN_REGISTRY////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+
+template <class T> Command* createBuiltIn(const CommandNode& node)
+{
+  return new T(node);
+}
+
+template <class T> Command* createJobsBuiltIn(const CommandNode& node)
+{
+  return new T(node,&JobsList::getInstance());
+}
+
+template <class T> Command* createAliasBuiltIn(const CommandNode& node)
+{
+  return new T(node,&AliasList::getInstance());
+}
+
+struct BuiltIn {
+  const char* name;
+  Command* (*create)(const CommandNode& node);
+  unsigned int flags;
+};
+
+// Every built-in registers here, sorted by name for the binary search in findBuiltIn.
+// The background sign never reaches the names, the parser takes it off the words.
+static constexpr BuiltIn BUILT_INS[] = {
+  {"alias", createAliasBuiltIn<aliasCommand>, BUILTIN_IN_PARENT | BUILTIN_REDIRECTABLE},
+  {"cd", createBuiltIn<ChangeDirCommand>, BUILTIN_IN_PARENT},
+  {"chprompt", createBuiltIn<ChangePromptCommand>, BUILTIN_IN_PARENT},
+  {"fg", createJobsBuiltIn<ForegroundCommand>, BUILTIN_IN_PARENT | BUILTIN_REDIRECTABLE},
+  {"getuser", createBuiltIn<GetUserCommand>, BUILTIN_REDIRECTABLE},
+  {"hash", createBuiltIn<HashCommand>, BUILTIN_IN_PARENT | BUILTIN_REDIRECTABLE},
+  {"jobs", createJobsBuiltIn<JobsCommand>, BUILTIN_REDIRECTABLE},
+  {"kill", createJobsBuiltIn<KillCommand>, BUILTIN_REDIRECTABLE},
+  {"listdir", createBuiltIn<ListDirCommand>, BUILTIN_REDIRECTABLE},
+  {"pwd", createBuiltIn<GetCurrDirCommand>, BUILTIN_REDIRECTABLE},
+  {"quit", createJobsBuiltIn<QuitCommand>, BUILTIN_IN_PARENT | BUILTIN_REDIRECTABLE},
+  {"showpid", createBuiltIn<ShowPidCommand>, BUILTIN_REDIRECTABLE},
+  {"unalias", createAliasBuiltIn<unaliasCommand>, BUILTIN_IN_PARENT},
+  {"watch", createBuiltIn<WatchCommand>, BUILTIN_RAW_LINE | BUILTIN_REDIRECTABLE},
+};
+
+constexpr size_t BUILT_INS_NUM = sizeof(BUILT_INS) / sizeof(BUILT_INS[0]);
+
+constexpr bool namePrecedes(const char* a, const char* b)
+{
+  return *a != *b ? (unsigned char)*a < (unsigned char)*b : (*a != '\0' && namePrecedes(a + 1, b + 1));
+}
+
+constexpr bool builtInsSorted(size_t i)
+{
+  return i + 1 >= BUILT_INS_NUM || (namePrecedes(BUILT_INS[i].name, BUILT_INS[i + 1].name) && builtInsSorted(i + 1));
+}
+
+static_assert(builtInsSorted(0), "BUILT_INS must be sorted by name");
+
+// at most 4 comparisons for the 14 names
+const BuiltIn* findBuiltIn(const char* name)
+{
+  size_t low = 0;
+  size_t high = BUILT_INS_NUM;
+  while (low < high)
+  {
+    size_t middle = (low + high) / 2;
+    int order = strcmp(name, BUILT_INS[middle].name);
+    if (order == 0)
+    {
+      return &BUILT_INS[middle];
+    }
+    if (order < 0)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle + 1;
     }
   }
+  return nullptr;
+}
+
+bool isItBuiltIn(std::string string)
+{
+  return findBuiltIn(string.c_str()) != nullptr;
+}
+
+// 0 for external commands and aliases (aliases can't take a built-in's name)
+static unsigned int builtInFlags(const CommandNode& node)
+{
+  const BuiltIn* builtIn = findBuiltIn(node.args[0]);
+  return builtIn != nullptr ? builtIn->flags : 0;
 }
 
 
@@ -691,11 +987,12 @@ void PipeCommand::execute()
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
 
-ChangePromptCommand::ChangePromptCommand(const char *cmd_line) : BuiltInCommand(cmd_line,false)
+ChangePromptCommand::ChangePromptCommand(const CommandNode& node) : BuiltInCommand(node,false)
 {
   if (args_num > 1)
   {
-    this->prompt = args[1];
+    // an & glued to the prompt is part of it ("chprompt hi&")
+    this->prompt = (args_num == 2 && node.background_word) ? node.background_word : args[1];
   }
 }
 
@@ -712,7 +1009,7 @@ void ChangePromptCommand::execute()
   }
 }
 
-ShowPidCommand::ShowPidCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+ShowPidCommand::ShowPidCommand(const CommandNode& node) : BuiltInCommand(node) {}
 
 void ShowPidCommand::execute()
 {
@@ -720,12 +1017,12 @@ void ShowPidCommand::execute()
 }
 
 
-GetCurrDirCommand::GetCurrDirCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+GetCurrDirCommand::GetCurrDirCommand(const CommandNode& node) : BuiltInCommand(node) {}
 
 void GetCurrDirCommand::execute()
 {
-  char buffer[COMMAND_MAX_LENGTH];
-  if(getcwd(buffer,COMMAND_MAX_LENGTH) == nullptr)
+  char buffer[SMASH_BUFFER_SIZE];
+  if(getcwd(buffer,sizeof(buffer)) == nullptr)
   {      
     perror("smash error: getcwd failed");
     return;
@@ -733,7 +1030,7 @@ void GetCurrDirCommand::execute()
   cout << buffer << endl;
 }
 
-ChangeDirCommand::ChangeDirCommand(const char *cmd_line) : BuiltInCommand(cmd_line){}
+ChangeDirCommand::ChangeDirCommand(const CommandNode& node) : BuiltInCommand(node){}
 
 void ChangeDirCommand::execute()
 {
@@ -754,8 +1051,8 @@ void ChangeDirCommand::execute()
       std::cerr << "smash error: cd: OLDPWD not set" << endl;
       return;
     }
-    char buffer[COMMAND_MAX_LENGTH];
-    if(getcwd(buffer,COMMAND_MAX_LENGTH) == nullptr)
+    char buffer[SMASH_BUFFER_SIZE];
+    if(getcwd(buffer,sizeof(buffer)) == nullptr)
     {      
       perror("smash error: getcwd failed");
       return;
@@ -773,8 +1070,8 @@ void ChangeDirCommand::execute()
   }
   else if (args_num == 2)
   {
-    char buffer[COMMAND_MAX_LENGTH];
-    if(getcwd(buffer,COMMAND_MAX_LENGTH) == nullptr)
+    char buffer[SMASH_BUFFER_SIZE];
+    if(getcwd(buffer,sizeof(buffer)) == nullptr)
     {      
       perror("smash error: getcwd failed");
       return;
@@ -792,14 +1089,14 @@ void ChangeDirCommand::execute()
   }
 }
 
-JobsCommand::JobsCommand(const char *cmd_line, JobsList* jobs): BuiltInCommand(cmd_line), jobs(jobs) {}
+JobsCommand::JobsCommand(const CommandNode& node, JobsList* jobs) : BuiltInCommand(node), jobs(jobs) {}
 
 void JobsCommand::execute()
 {
   this->jobs->printJobsList();
 }
 
-ForegroundCommand::ForegroundCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+ForegroundCommand::ForegroundCommand(const CommandNode& node, JobsList *jobs) : BuiltInCommand(node), jobs(jobs) {}
 
 void ForegroundCommand::execute()
 {
@@ -829,9 +1126,9 @@ void ForegroundCommand::execute()
         return;
       }
       job = jobs->getLastJob();
-      job->setAsForeground();
+      jobs->setForeground(job->getId());
       job->printJobEntryWithPid();
-      if (waitpid(job->getPid(),nullptr,0) == -1)
+      if (!jobs->waitForJob(job->getId()))
       {
         perror("smash error: waitpid failed");
         return;
@@ -847,9 +1144,9 @@ void ForegroundCommand::execute()
       }
       else 
       {
-        job->setAsForeground();
+        jobs->setForeground(job->getId());
         job->printJobEntryWithPid();
-        if (waitpid(job->getPid(),nullptr,0) == -1)
+        if (!jobs->waitForJob(job->getId()))
         {
           perror("smash error: waitpid failed");
           return;
@@ -860,7 +1157,7 @@ void ForegroundCommand::execute()
   }
 }
 
-QuitCommand::QuitCommand(const char *cmd_line, JobsList* jobs): BuiltInCommand(cmd_line), jobs(jobs) {}
+QuitCommand::QuitCommand(const CommandNode& node, JobsList* jobs) : BuiltInCommand(node), jobs(jobs) {}
 
 void QuitCommand::execute()
 {
@@ -884,7 +1181,7 @@ void QuitCommand::execute()
   }
 }
 
-KillCommand::KillCommand(const char *cmd_line, JobsList* jobs): BuiltInCommand(cmd_line), jobs(jobs) {}
+KillCommand::KillCommand(const CommandNode& node, JobsList* jobs) : BuiltInCommand(node), jobs(jobs) {}
 
 void KillCommand::execute()
 {
@@ -911,22 +1208,9 @@ void KillCommand::execute()
   }
 }
 
-aliasCommand::aliasCommand(const char *cmd_line,AliasList* alias_list) : BuiltInCommand(cmd_line),
+aliasCommand::aliasCommand(const CommandNode& node,AliasList* alias_list) : BuiltInCommand(node),
                                                                           alias_list(alias_list) {}
 
-bool isItBuiltIn(std::string string)
-{
-  if (!string.compare("showpid") || !string.compare("chprompt") || !string.compare("pwd") ||
-      !string.compare("cd") || !string.compare("fg") || !string.compare("kill") ||
-      !string.compare("quit") || !string.compare("alias") || !string.compare("unalias") ||
-      !string.compare("getuser") || !string.compare("watch") || !string.compare("jobs") ||
-      !string.compare("listdir"))
-  {
-    return true;
-  }
-  return false;
-}
-
 void aliasCommand::execute()
 {
   string tmp = this->cmd_line;
@@ -963,7 +1247,7 @@ void aliasCommand::execute()
   }
 }
 
-unaliasCommand::unaliasCommand(const char *cmd_line,AliasList* alias_list) : BuiltInCommand(cmd_line),
+unaliasCommand::unaliasCommand(const CommandNode& node,AliasList* alias_list) : BuiltInCommand(node),
                                                                              alias_list(alias_list) {}
 
 void unaliasCommand::execute()
@@ -991,6 +1275,36 @@ void unaliasCommand::execute()
 }
 
 
+HashCommand::HashCommand(const CommandNode& node) : BuiltInCommand(node) {}
+
+void HashCommand::execute()
+{
+  SmallShell& smash = SmallShell::getInstance();
+  if (args_num == 1)
+  {
+    smash.printHashTable();
+  }
+  else if (strcmp(args[1],"-r") == 0)
+  {
+    smash.clearHashTable();
+  }
+  else if (args[1][0] == '-')
+  {
+    cerr << "smash error: hash: invalid arguments" << endl;
+  }
+  else
+  {
+    for (int i = 1; i < args_num; i++)
+    {
+      if (smash.findCommand(args[i],false).empty())
+      {
+        cerr << "smash error: hash: " << args[i] << " not found" << endl;
+      }
+    }
+  }
+}
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////SMALL_SHELL//////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -1003,130 +1317,89 @@ SmallShell::SmallShell() : prompt("smash"), last_pwd("")
 /**
 * Creates and returns a pointer to Command class which matches the given command line (cmd_line)
 */
-int _parseCommandLinePrivate(const char *cmd_line, char **args) {
-    FUNC_ENTRY()
-    int i = 0;
-    std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;) {
-        args[i] = new char[s.length()+1];;
-        memset(args[i], 0, s.length() + 1);
-        strcpy(args[i], s.c_str());
-        args[++i] = NULL;
-    }
-    return i;
-
-    FUNC_EXIT()
-}
-
 Command *SmallShell::CreateCommand(const char *cmd_line) 
 {
-  string cmd_s = _trim(string(cmd_line));
-  string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
   std::string original_cmd_line = cmd_line;
   bool isAlias = false;
-  if (AliasList::getInstance().aliasNameAlreadyExists(firstWord))
-  {
-    isAlias = true;
-    char * copy_original_cmd_line = new char[string(original_cmd_line).length()+1];
-    strcpy(copy_original_cmd_line,original_cmd_line.c_str());
-    cmd_line = AliasList::getInstance().getAliasCmdLineByName(firstWord).c_str();
-    char * copy_cmd_line = new char[string(cmd_line).length()+1];
-    strcpy(copy_cmd_line,cmd_line);
-    char* args[COMMAND_MAX_ARGS+1];
-    int args_num = 0;
-    args_num = _parseCommandLinePrivate(copy_original_cmd_line,args);
-    std::string tmp_str = copy_cmd_line;
-    for (int i = 1 ; i < args_num; i++)
-    {
-      tmp_str = tmp_str + " " + string(args[i]);
-    }
-    cmd_line = new char[tmp_str.length() + 1];
-    strcpy((char*)cmd_line,tmp_str.c_str());
-    cmd_s = _trim(string(cmd_line));
-    firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
-  }
-  std::regex pattern("^alias [a-zA-Z0-9_]+='[^']*'$");
-  if (_isBackgroundComamnd(cmd_s.c_str()))
-  {
-      _removeBackgroundSign((char*)cmd_s.c_str());
-      cmd_s = _trim(cmd_s);
-  }
-  if (cmd_s.find('>') != std::string::npos && !std::regex_match(cmd_s,pattern) && firstWord.compare("watch") != 0)
+  LineNode line;
+  const char* error = parseLine(cmd_line,this->arena,&line);
+  if (error == nullptr && line.stages_num > 0)
   {
-    return new RedirectionCommand(cmd_line);
-  }
-  if (cmd_s.find('|') != std::string::npos && !std::regex_match(cmd_s,pattern) && firstWord.compare("watch") != 0)
-  {
-    return new PipeCommand(cmd_line);
-  }
-  if (firstWord.compare("chprompt&") == 0 || firstWord.compare("chprompt") == 0) 
-  {
-    return new ChangePromptCommand(cmd_line);
-  }
-  else if (firstWord.compare("showpid&") == 0 || firstWord.compare("showpid") == 0) 
-  {
-    return new ShowPidCommand(cmd_line);
-  }
-  else if (firstWord.compare("pwd&") == 0 || firstWord.compare("pwd") == 0) 
-  {
-    return new GetCurrDirCommand(cmd_line);
-  }
-  else if (firstWord.compare("cd&") == 0 || firstWord.compare("cd") == 0) 
-  {
-    return new ChangeDirCommand(cmd_line);
-  }
-  else if (firstWord.compare("jobs") == 0 || firstWord.compare("jobs&") == 0) 
-  {
-    return new JobsCommand(cmd_line,&JobsList::getInstance());
-  }
-  else if (firstWord.compare("fg") == 0 || firstWord.compare("fg&") == 0) 
-  {
-    return new ForegroundCommand(cmd_line,&JobsList::getInstance());
-  }
-  else if (firstWord.compare("quit") == 0 || firstWord.compare("quit&") == 0) 
-  {
-    return new QuitCommand(cmd_line,&JobsList::getInstance());
+    const char* firstWord = line.stages[0].args[0];
+    size_t length = strlen(firstWord);
+    if (strncmp(line.text,firstWord,length) == 0 && AliasList::getInstance().aliasNameAlreadyExists(firstWord))
+    {
+      // the alias replaces the first word, the rest of the line is kept as typed
+      isAlias = true;
+      std::string expanded = AliasList::getInstance().getAliasCmdLineByName(firstWord) + (line.text + length);
+      error = parseLine(expanded.c_str(),this->arena,&line);
+    }
   }
-  else if (firstWord.compare("kill") == 0 || firstWord.compare("kill&") == 0) 
+  if (error != nullptr)
   {
-    return new KillCommand(cmd_line,&JobsList::getInstance());
+    cerr << "smash error: " << error << endl;
+    return nullptr;
   }
-  else if (firstWord.compare("alias") == 0 || firstWord.compare("alias&") == 0) 
+  if (line.stages_num == 0)
   {
-    return new aliasCommand(cmd_line,&AliasList::getInstance());
+    return nullptr;
   }
-  else if (firstWord.compare("unalias") == 0 || firstWord.compare("unalias&") == 0) 
+  const BuiltIn* builtIn = findBuiltIn(line.stages[0].args[0]);
+  if (builtIn != nullptr && (builtIn->flags & BUILTIN_RAW_LINE) &&
+      (line.stages_num > 1 || line.redirect_path != nullptr))
   {
-    return new unaliasCommand(cmd_line,&AliasList::getInstance());
+    parseLine(line.text,this->arena,&line,false);
   }
-  else if (firstWord.compare("listdir") == 0 || firstWord.compare("listdir&") == 0) 
+  if (line.redirect_path != nullptr)
   {
-    return new ListDirCommand(cmd_line);
+    return new RedirectionCommand(line);
   }
-  else if (firstWord.compare("getuser") == 0 || firstWord.compare("getuser&") == 0) 
+  if (line.stages_num > 1)
   {
-    return new GetUserCommand(cmd_line);
+    return new PipeCommand(line);
   }
-  else if (firstWord.compare("watch") == 0 || firstWord.compare("watch&") == 0) 
+  return createSimpleCommand(line.stages[0],original_cmd_line,isAlias);
+}
+
+// for the stages of a line that is already parsed
+Command *SmallShell::CreateCommand(const CommandNode& node)
+{
+  if (AliasList::getInstance().aliasNameAlreadyExists(node.args[0]))
   {
-    return new WatchCommand(cmd_line);
+    return CreateCommand(node.text);
   }
-  else 
+  return createSimpleCommand(node,node.text,false);
+}
+
+Command *SmallShell::createSimpleCommand(const CommandNode& node, const std::string& original_cmd_line, bool isAlias)
+{
+  const BuiltIn* builtIn = findBuiltIn(node.args[0]);
+  if (builtIn != nullptr)
   {
-    return new ExternalCommand(cmd_line,original_cmd_line,isAlias);
+    return builtIn->create(node);
   }
-  return nullptr;
+  return new ExternalCommand(node,original_cmd_line,isAlias);
 }
 
 void SmallShell::executeCommand(const char *cmd_line) 
 {
+#ifdef SMASH_USE_SALLOCATOR
+  size_t allocations_before = sallocatorAllocations();
+#endif
   JobsList::getInstance().removeFinishedJobs();
+  this->arena.reset();
   Command* cmd = CreateCommand(cmd_line);
   if (!cmd)
   {
     return;
   }
   cmd->execute();
+#ifdef SMASH_USE_SALLOCATOR
+  if (getenv("SMASH_ALLOC_STATS") != NULL)
+  {
+    cerr << "smash: " << sallocatorAllocations() - allocations_before << " allocations" << endl;
+  }
+#endif
 }
 
 void SmallShell::setPrompt(const std::string & new_prompt)
@@ -1154,22 +1427,118 @@ std::string SmallShell::getLastPwd()
   return this->last_pwd;
 }
 
+long long _dirMtime(const std::string& dir)
+{
+  struct stat status;
+  if (stat(dir.c_str(),&status) == -1)
+  {
+    return -1;
+  }
+  return status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+}
+
+// starts over when PATH is not the one the table was filled from
+void SmallShell::syncHashPath()
+{
+  const char* path_env = getenv("PATH");
+  std::string path = path_env ? path_env : "/bin:/usr/bin"; // execvp's default
+  if (!this->hash_dirs.empty() && path == this->hash_path)
+  {
+    return;
+  }
+  clearHashTable();
+  this->hash_path = path;
+  size_t start = 0;
+  while (true)
+  {
+    size_t colon = path.find(':',start);
+    std::string dir = path.substr(start,colon == std::string::npos ? std::string::npos : colon - start);
+    this->hash_dirs.push_back(dir.empty() ? "." : dir);
+    this->hash_dirs_mtime.push_back(_dirMtime(this->hash_dirs.back()));
+    if (colon == std::string::npos)
+    {
+      break;
+    }
+    start = colon + 1;
+  }
+}
+
+// Resolves a command name through PATH like execvp, remembering the result. Like
+// bash, an entry is trusted while PATH and the mtime of its own directory are
+// unchanged. count_hit is false for lookups that don't run the command (hash name).
+// Returns "" when nothing executable is found.
+std::string SmallShell::findCommand(const std::string& name, bool count_hit)
+{
+  if (name.find('/') != std::string::npos)
+  {
+    return name;
+  }
+  syncHashPath();
+  std::unordered_map<std::string, HashEntry>::iterator entry = this->hash_table.find(name);
+  if (entry != this->hash_table.end())
+  {
+    size_t dir = entry->second.dir_index;
+    if (_dirMtime(this->hash_dirs[dir]) == this->hash_dirs_mtime[dir])
+    {
+      entry->second.hits += count_hit ? 1 : 0;
+      return entry->second.path;
+    }
+    clearHashTable();
+    syncHashPath();
+  }
+  for (size_t i = 0; i < this->hash_dirs.size(); i++)
+  {
+    std::string candidate = this->hash_dirs[i] + "/" + name;
+    struct stat status;
+    if (stat(candidate.c_str(),&status) == 0 && S_ISREG(status.st_mode) && access(candidate.c_str(),X_OK) == 0)
+    {
+      HashEntry new_entry = {candidate, i, count_hit ? 1 : 0};
+      this->hash_table[name] = new_entry;
+      return candidate;
+    }
+  }
+  return "";
+}
+
+void SmallShell::printHashTable()
+{
+  if (this->hash_table.empty())
+  {
+    cout << "hash: hash table empty" << endl;
+    return;
+  }
+  cout << "hits\tcommand" << endl;
+  for (const std::pair<const std::string, HashEntry>& entry : this->hash_table)
+  {
+    cout << std::setw(4) << entry.second.hits << "\t" << entry.second.path << endl;
+  }
+}
+
+void SmallShell::clearHashTable()
+{
+  this->hash_table.clear();
+  this->hash_path.clear();
+  this->hash_dirs.clear();
+  this->hash_dirs_mtime.clear();
+}
+
 
 //////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////ALIAS_ENTRY/////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////
 
 
-AliasList::AliasEntry::AliasEntry(std::string cmd_line,std::string name) : cmd_line(cmd_line) , name(name){}
+AliasList::AliasEntry::AliasEntry(std::string cmd_line,std::string name) : cmd_line(cmd_line.c_str()) ,
+                                                                             name(name.c_str()) {}
 
 std::string AliasList::AliasEntry::getAliasEntryCmdLine()
 {
-  return this->cmd_line;
+  return std::string(this->cmd_line.c_str());
 }
 
 std::string AliasList::AliasEntry::getAliasEntryName()
 {
-  return this->name;
+  return std::string(this->name.c_str());
 }
 
 bool AliasList::AliasEntry::operator==(const AliasEntry &alias_entry) const
@@ -1198,7 +1567,7 @@ void AliasList::AliasEntry::printAliasEntry()
 /////////////////////////////////////////////////////////////////////////////////////
 
 
-AliasList::AliasList() : alias_list(std::vector<AliasEntry>()) {}
+AliasList::AliasList() : alias_list(AliasVector()) {}
 
 void AliasList::printList()
 {
@@ -1234,7 +1603,7 @@ void AliasList::removeAliasByName(std::string name)
   {
     if (alias_entry.getAliasEntryName().compare(name) == 0 )
     {
-      alias_list.erase(std::vector<AliasEntry>::const_iterator(&alias_entry));
+      alias_list.erase(alias_list.begin() + (&alias_entry - alias_list.data()));
       return;
     }
   }
@@ -1263,8 +1632,10 @@ void AliasList::addAlias(std::string alias_cmd_line,std::string name)
 /////////////////////////////////////////////////////////////////////////////////////
 
 
-JobsList::JobEntry::JobEntry(std::string cmd_line, int job_id, int pid, bool background):
-    cmd_line(cmd_line),id(job_id),pid(pid),background(background){}
+JobsList::JobEntry::JobEntry(std::string cmd_line, int job_id, int pid, bool background, bool process_group,
+                             int pidfd):
+    cmd_line(cmd_line.c_str()),id(job_id),pid(pid),background(background),process_group(process_group),
+    pidfd(pidfd){}
 
 bool JobsList::JobEntry::operator==(const JobEntry &job) const
 {
@@ -1291,6 +1662,45 @@ pid_t JobsList::JobEntry::getPid()
   return this->pid;
 }
 
+pid_t JobsList::JobEntry::getSignalTarget()
+{
+  return this->process_group ? -this->pid : this->pid;
+}
+
+int JobsList::JobEntry::getPidfd()
+{
+  return this->pidfd;
+}
+
+// from now on the job is checked on SIGCHLD
+void JobsList::JobEntry::unwatch()
+{
+  EventLoop::getInstance().unwatchJob(this->pidfd);
+  this->pidfd = -1;
+}
+
+// reaps whatever exited, a process group job is finished once none of its members is left
+bool JobsList::JobEntry::isFinished()
+{
+  if (!this->process_group)
+  {
+    return waitpid(this->pid,nullptr,WNOHANG) != 0;
+  }
+  pid_t reaped;
+  while ((reaped = waitpid(-this->pid,nullptr,WNOHANG)) > 0) {}
+  return reaped == -1;
+}
+
+bool JobsList::JobEntry::waitForJob()
+{
+  if (!this->process_group)
+  {
+    return waitpid(this->pid,nullptr,0) != -1;
+  }
+  while (waitpid(-this->pid,nullptr,0) > 0) {}
+  return errno == ECHILD;
+}
+
 void JobsList::JobEntry::printJobEntryWithId()
 {
   cout << "[" << this->id << "] " << this->cmd_line << endl;
@@ -1303,7 +1713,7 @@ void JobsList::JobEntry::printJobEntryWithPid()
 
 void JobsList::JobEntry::killJob()
 {
-  if (kill(pid,SIGKILL) == -1)
+  if (kill(getSignalTarget(),SIGKILL) == -1)
   {
     perror("smash error: kill failed");
   }
@@ -1312,7 +1722,7 @@ void JobsList::JobEntry::killJob()
 
 void JobsList::JobEntry::sendSignal(int signal)
 {
-  if (kill(pid,signal) == -1)
+  if (kill(getSignalTarget(),signal) == -1)
   {
     perror("smash error: kill failed");
   }
@@ -1335,21 +1745,40 @@ void JobsList::JobEntry::setAsForeground()
 //////////////////////////////////////////////////////////////////////////////////
 
 
-JobsList::JobsList() : jobs_list(std::vector<JobEntry>()), max_id_in_list(0) {}
+JobsList::JobsList() : jobs_list(), pid_index(), unwatched(), max_id_in_list(NO_JOBS_ID), foreground_id(NO_JOBS_ID) {}
 
-void JobsList::addJob(std::string cmd_line, pid_t pid,bool background)
+int JobsList::addJob(std::string cmd_line, pid_t pid,bool background, bool process_group)
 {
   removeFinishedJobs();
-  this->jobs_list.push_back(JobEntry( cmd_line, max_id_in_list + 1, pid, background));
-  this->max_id_in_list++;
+  int id = max_id_in_list + 1;
+  int pidfd = EventLoop::getInstance().watchJob(pid,id);
+  this->jobs_list.emplace_hint(this->jobs_list.end(), id, JobEntry(cmd_line, id, pid, background, process_group, pidfd));
+  this->pid_index[pid] = id;
+  if (pidfd == -1)
+  {
+    this->unwatched.insert(id);
+  }
+  if (!background)
+  {
+    this->foreground_id = id;
+  }
+  this->max_id_in_list = id;
+  return id;
 }
 
 void JobsList::removeFinishedJobs()
 {
-  for (JobEntry job_entry : jobs_list)
+  if (EventLoop::getInstance().isActive())
+  {
+    // exits arrive as events, only the pending ones are left to handle
+    EventLoop::getInstance().poll();
+    return;
+  }
+  for (JobsMap::iterator it = jobs_list.begin(); it != jobs_list.end();)
   {
-    pid_t pid = waitpid(job_entry.getPid(),nullptr,WNOHANG);
-    if (pid != 0)
+    JobEntry& job_entry = it->second;
+    ++it;
+    if (job_entry.isFinished())
     {
       this->removeJobById(job_entry.getId());
     }
@@ -1358,64 +1787,58 @@ void JobsList::removeFinishedJobs()
 
 void JobsList::updateMaxId()
 {
-  int tmp_max_id = NO_JOBS_ID;
-  for (JobEntry job_entry : jobs_list)
-  {
-    if (job_entry.getId() > tmp_max_id)
-    {
-      tmp_max_id = job_entry.getId();
-    }
-  }
-  this->max_id_in_list = tmp_max_id;
+  this->max_id_in_list = jobs_list.empty() ? NO_JOBS_ID : jobs_list.rbegin()->first;
 }
 
 void JobsList::removeJobById(int jobId)
 {
-  for (JobEntry& job_entry : jobs_list) 
+  JobsMap::iterator it = jobs_list.find(jobId);
+  if (it == jobs_list.end())
   {
-    if (job_entry.getId() == jobId)
-    {
-      jobs_list.erase(std::vector<JobEntry>::const_iterator(&job_entry));
-      break;
-    }
+    return;
+  }
+  JobEntry& job_entry = it->second;
+  job_entry.unwatch();
+  PidIndex::iterator indexed = pid_index.find(job_entry.getPid());
+  if (indexed != pid_index.end() && indexed->second == jobId)
+  {
+    pid_index.erase(indexed);
+  }
+  this->unwatched.erase(jobId);
+  if (this->foreground_id == jobId)
+  {
+    this->foreground_id = NO_JOBS_ID;
   }
+  jobs_list.erase(it);
   this->updateMaxId();
-  removeFinishedJobs();
 }
 
 void JobsList::printJobsList()
 {
   removeFinishedJobs();
-  for (JobEntry job_entry : jobs_list)
+  for (JobsMap::value_type& entry : jobs_list)
   {
-    job_entry.printJobEntryWithId();
+    entry.second.printJobEntryWithId();
   }
 }
 
 JobsList::JobEntry * JobsList::getLastJob()
 {
   removeFinishedJobs();
-  if (!max_id_in_list)
+  if (jobs_list.empty())
   {
     return nullptr;
   }
-  return &this->jobs_list.back();
+  return &jobs_list.rbegin()->second;
 }
 
 JobsList::JobEntry * JobsList::getJobById(int jobId)
 {
   removeFinishedJobs();
-  for (JobEntry& job_entry : jobs_list)
-  {
-    if (job_entry.getId() == jobId)
-    {
-      return &job_entry;
-    }
-  }
-  return nullptr;
+  return findJob(jobId);
 }
 
-std::vector<JobsList::JobEntry> * JobsList::getJobsList()
+JobsList::JobsMap * JobsList::getJobsList()
 {
   return &this->jobs_list;
 }
@@ -1423,34 +1846,87 @@ std::vector<JobsList::JobEntry> * JobsList::getJobsList()
 void JobsList::killAllJobs()
 {
   removeFinishedJobs();
-  for (JobEntry job_entry : jobs_list)
+  for (JobsMap::value_type& entry : jobs_list)
   {
-    job_entry.killJob();
+    entry.second.killJob();
   }
 }
 
 bool JobsList::isJobExistsByPid(pid_t pid)
 {
   removeFinishedJobs();
-  for (JobEntry job_entry : jobs_list)
-  {
-    if (job_entry.getPid() == pid)
-    {
-      return true;
-    }
-  }
-  return false;
+  return pid_index.find(pid) != pid_index.end();
 }
 
 JobsList::JobEntry *JobsList::getJobInForeground()
 {
   removeFinishedJobs();
-  for (JobEntry& job_entry : jobs_list)
+  JobEntry* job = findJob(this->foreground_id);
+  if (job != nullptr && job->getBackground() == false)
   {
-    if (job_entry.getBackground() == false)
+    return job;
+  }
+  return nullptr;
+}
+
+void JobsList::setForeground(int jobId)
+{
+  JobEntry* job = findJob(jobId);
+  if (job != nullptr)
+  {
+    job->setAsForeground();
+    this->foreground_id = jobId;
+  }
+}
+
+// no reaping, unlike getJobById
+JobsList::JobEntry *JobsList::findJob(int jobId)
+{
+  JobsMap::iterator it = jobs_list.find(jobId);
+  return it == jobs_list.end() ? nullptr : &it->second;
+}
+
+// waits for a job in the foreground, through the event loop when smash runs one
+bool JobsList::waitForJob(int jobId)
+{
+  if (EventLoop::getInstance().isActive())
+  {
+    EventLoop::getInstance().waitForJob(jobId);
+    return true;
+  }
+  JobEntry* job = findJob(jobId);
+  return job == nullptr || job->waitForJob();
+}
+
+// the pidfd of the job became readable
+void JobsList::jobExited(int jobId)
+{
+  JobEntry* job = findJob(jobId);
+  if (job == nullptr)
+  {
+    return;
+  }
+  if (job->isFinished())
+  {
+    removeJobById(jobId);
+    return;
+  }
+  // a pipeline whose leader exited before the other stages
+  job->unwatch();
+  this->unwatched.insert(jobId);
+}
+
+// on SIGCHLD, only the jobs without a pidfd are checked
+void JobsList::checkUnwatchedJobs()
+{
+  for (IdSet::iterator it = unwatched.begin(); it != unwatched.end();)
+  {
+    int id = *it;
+    ++it;
+    JobEntry* job = findJob(id);
+    if (job != nullptr && job->isFinished())
     {
-      return &job_entry;
+      this->removeJobById(id);
     }
   }
-  return nullptr;
-}
\ No newline at end of file
+}
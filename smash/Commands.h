@@ -2,9 +2,32 @@
 #define SMASH_COMMAND_H_
 
 #include <vector>
-
-#define COMMAND_MAX_LENGTH (200)
-#define COMMAND_MAX_ARGS (20)
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <stdlib.h>
+#include <spawn.h>
+#include "Parser.h"
+
+// Build with -DSMASH_USE_SALLOCATOR (and link VM/malloc_3.cpp) to run the shell on the
+// malloc_3 heap: the long-lived containers through SAllocator, the line arena through
+// SMASH_MALLOC and every other C++ allocation through operator new (Commands.cpp).
+// Allocations made inside the C library (glob, getpwuid, stdio buffers) stay on malloc.
+#ifdef SMASH_USE_SALLOCATOR
+#include "../VM/sallocator.h"
+template <class T> using SmashAllocator = SAllocator<T>;
+#define SMASH_MALLOC(size) (sallocatorAllocations()++, smalloc(size))
+#define SMASH_FREE(p) sfree(p)
+#else
+template <class T> using SmashAllocator = std::allocator<T>;
+#define SMASH_MALLOC(size) malloc(size)
+#define SMASH_FREE(p) free(p)
+#endif
+
+typedef std::basic_string<char, std::char_traits<char>, SmashAllocator<char> > SmashString;
+
+#define SMASH_BUFFER_SIZE (4096) // getcwd, getdents and /proc reads
 
 #define NO_JOBS_ID 0
 
@@ -20,13 +43,14 @@ class AliasList;
 
 class Command {
 protected:
-    char* args[COMMAND_MAX_ARGS + 1];
+    char** args; // NULL terminated, in the arena of the line
     int args_num;
     char* cmd_line;
     bool isBackground;
 public:
-    Command(const char *cmd_line);
-    virtual ~Command();
+    Command(const CommandNode& node);
+    Command(const LineNode& line); // a whole line, without words of its own
+    virtual ~Command() = default;
     virtual void execute() = 0;
     //virtual void prepare();
     //virtual void cleanup();
@@ -41,7 +65,7 @@ public:
 
 class BuiltInCommand : public Command {
 public:
-    BuiltInCommand(const char *cmd_line,bool remove_bachground_sing = true);
+    BuiltInCommand(const CommandNode& node,bool remove_bachground_sing = true);
     virtual ~BuiltInCommand() = default;
 };
 
@@ -54,10 +78,19 @@ public:
 class ExternalCommand : public Command {
     std::string original_cmd_line;
     bool isAlias;
+    char* bare_cmd_line; // without the background sign
+    const char* bash_args[4];
+    bool use_bash;
+    std::vector<std::string> expanded_args;
+    std::vector<char*> exec_args;
+    std::string exec_path; // resolved through SmallShell's hash table, "" when not found
 public:
-    ExternalCommand(const char *cmd_line,std::string original_cmd_line, bool isAlias);
+    ExternalCommand(const CommandNode& node,std::string original_cmd_line, bool isAlias);
     virtual ~ExternalCommand() = default;
     void execute() override;
+    void prepareArgs();
+    void exec();
+    pid_t spawn(const posix_spawn_file_actions_t* file_actions, pid_t process_group);
 };
 
 
@@ -67,8 +100,9 @@ public:
 
 
 class RedirectionCommand : public Command {
+    LineNode line;
 public:
-    explicit RedirectionCommand(const char *cmd_line);
+    explicit RedirectionCommand(const LineNode& line);
     virtual ~RedirectionCommand() = default;
     void execute() override;
 };
@@ -81,7 +115,7 @@ public:
 
 class ListDirCommand : public BuiltInCommand {
 public:
-    ListDirCommand(const char *cmd_line);
+    ListDirCommand(const CommandNode& node);
     virtual ~ListDirCommand() = default;
     void execute() override;
 };
@@ -94,7 +128,7 @@ public:
 
 class GetUserCommand : public BuiltInCommand {
 public:
-    GetUserCommand(const char *cmd_line);
+    GetUserCommand(const CommandNode& node);
     virtual ~GetUserCommand() = default;
     void execute() override;
 };
@@ -104,15 +138,18 @@ public:
 ##################################################################################################*/
 
 class PipeCommand : public Command {
+    const CommandNode* stages;
+    const bool* stderr_edges; // stderr_edges[i] is true when stage i pipes its stderr (|&)
+    int stages_num;
 public:
-    PipeCommand(const char *cmd_line);
+    PipeCommand(const LineNode& line);
     virtual ~PipeCommand() = default;
     void execute() override;
 };
 
 class WatchCommand : public Command {
 public:
-    WatchCommand(const char *cmd_line);
+    WatchCommand(const CommandNode& node);
     virtual ~WatchCommand() = default;
     void execute() override;
 };
@@ -126,28 +163,28 @@ public:
 class ChangePromptCommand : public BuiltInCommand {
     std::string prompt;
 public:
-    ChangePromptCommand(const char *cmd_line);
+    ChangePromptCommand(const CommandNode& node);
     virtual ~ChangePromptCommand() = default;
     void execute() override;
 };
 
 class ShowPidCommand : public BuiltInCommand {
 public:
-    ShowPidCommand(const char *cmd_line);
+    ShowPidCommand(const CommandNode& node);
     virtual ~ShowPidCommand() = default;
     void execute() override;
 };
 
 class GetCurrDirCommand : public BuiltInCommand {
 public:
-    GetCurrDirCommand(const char *cmd_line);
+    GetCurrDirCommand(const CommandNode& node);
     virtual ~GetCurrDirCommand() = default;
     void execute() override;
 };
 
 class ChangeDirCommand : public BuiltInCommand {
 public:
-    ChangeDirCommand(const char *cmd_line);
+    ChangeDirCommand(const CommandNode& node);
     virtual ~ChangeDirCommand() = default;
     void execute() override;
 };
@@ -155,7 +192,7 @@ public:
 class JobsCommand : public BuiltInCommand {
     JobsList* jobs;
 public:
-    JobsCommand(const char *cmd_line, JobsList* jobs);
+    JobsCommand(const CommandNode& node, JobsList* jobs);
     virtual ~JobsCommand() = default;
     void execute() override;
 };
@@ -163,7 +200,7 @@ public:
 class ForegroundCommand : public BuiltInCommand {
     JobsList* jobs;
 public:
-    ForegroundCommand(const char *cmd_line, JobsList *jobs);
+    ForegroundCommand(const CommandNode& node, JobsList *jobs);
     virtual ~ForegroundCommand() = default;
     void execute() override;
 };
@@ -171,7 +208,7 @@ public:
 class QuitCommand : public BuiltInCommand {
     JobsList* jobs;
 public:
-    QuitCommand(const char *cmd_line, JobsList *jobs);
+    QuitCommand(const CommandNode& node, JobsList *jobs);
     virtual ~QuitCommand() = default;
     void execute() override;
 };
@@ -179,7 +216,7 @@ public:
 class KillCommand : public BuiltInCommand {
     JobsList* jobs;
 public:
-    KillCommand(const char *cmd_line, JobsList *jobs);
+    KillCommand(const CommandNode& node, JobsList *jobs);
     virtual ~KillCommand() = default;
     void execute() override;
 };
@@ -187,7 +224,7 @@ public:
 class aliasCommand : public BuiltInCommand {
     AliasList * alias_list;
 public:
-    aliasCommand(const char *cmd_line,AliasList* alias_list);
+    aliasCommand(const CommandNode& node,AliasList* alias_list);
     virtual ~aliasCommand() = default;
     void execute() override;
 };
@@ -195,11 +232,18 @@ public:
 class unaliasCommand : public BuiltInCommand {
     AliasList * alias_list;
 public:
-    unaliasCommand(const char *cmd_line,AliasList* alias_list);
+    unaliasCommand(const CommandNode& node,AliasList* alias_list);
     virtual ~unaliasCommand() = default;
     void execute() override;
 };
 
+class HashCommand : public BuiltInCommand {
+public:
+    HashCommand(const CommandNode& node);
+    virtual ~HashCommand() = default;
+    void execute() override;
+};
+
 
 /*################################################################################################
 ###########################################ALIAS_LIST_&_ENTRY#####################################
@@ -209,8 +253,8 @@ public:
 class AliasList {
 public:
         class AliasEntry {
-            std::string cmd_line;
-            std::string name;
+            SmashString cmd_line;
+            SmashString name;
         public:
             AliasEntry(std::string cmd_line,std::string name);
             AliasEntry(AliasEntry const&) = default;
@@ -223,8 +267,9 @@ public:
             std::string getAliasEntryCmdLine();
             void printAliasEntry();
         };
+        typedef std::vector<AliasEntry, SmashAllocator<AliasEntry> > AliasVector;
 private:
-    std::vector<AliasEntry> alias_list;
+    AliasVector alias_list;
 public:
     AliasList();
     ~AliasList() = default;
@@ -250,12 +295,15 @@ public:
 class JobsList {
 public:
         class JobEntry {
-            std::string cmd_line;
+            SmashString cmd_line;
             int id;
             pid_t pid;
             bool background;
+            bool process_group; // pid leads a process group holding every process of the job
+            int pidfd; // reports the exit in the event loop, -1 when the job is left to SIGCHLD
         public:
-            JobEntry(std::string cmd_line, int job_id, int pid, bool background);
+            JobEntry(std::string cmd_line, int job_id, int pid, bool background, bool process_group = false,
+                     int pidfd = -1);
             JobEntry(JobEntry const&) = default;
             ~JobEntry() = default;
             JobEntry& operator=(JobEntry const&) = default;
@@ -264,6 +312,11 @@ public:
             bool operator<(const JobEntry &job_entry) const;           
             int getId();
             pid_t getPid();
+            pid_t getSignalTarget();
+            int getPidfd();
+            void unwatch();
+            bool isFinished();
+            bool waitForJob();
             void printJobEntryWithId();
             void printJobEntryWithPid();
             void killJob();
@@ -271,9 +324,17 @@ public:
             bool getBackground();
             void setAsForeground();
         };
+        // ordered by id, so jobs print in order and the last job is the one with the largest id
+        typedef std::map<int, JobEntry, std::less<int>, SmashAllocator<std::pair<const int, JobEntry> > > JobsMap;
+        typedef std::unordered_map<pid_t, int, std::hash<pid_t>, std::equal_to<pid_t>,
+                                   SmashAllocator<std::pair<const pid_t, int> > > PidIndex;
+        typedef std::set<int, std::less<int>, SmashAllocator<int> > IdSet;
 private:
-    std::vector<JobEntry> jobs_list;
+    JobsMap jobs_list;
+    PidIndex pid_index; // pid -> id
+    IdSet unwatched; // ids of the jobs without a pidfd
     int max_id_in_list;
+    int foreground_id; // NO_JOBS_ID when no job runs in the foreground
 public:
     JobsList();
     ~JobsList() = default;
@@ -282,7 +343,7 @@ public:
         static JobsList instance;
         return instance;
     }
-    void addJob(std::string cmd_line, pid_t pid,bool background = true);
+    int addJob(std::string cmd_line, pid_t pid,bool background = true, bool process_group = false);
     void printJobsList();
     void killAllJobs();
     void removeFinishedJobs();
@@ -290,9 +351,14 @@ public:
     void removeJobById(int jobId);
     JobEntry *getLastJob();
     void updateMaxId();
-    std::vector<JobEntry> * getJobsList();
+    JobsMap * getJobsList();
     bool isJobExistsByPid(pid_t pid);
     JobEntry *getJobInForeground();
+    void setForeground(int jobId);
+    JobEntry *findJob(int jobId);
+    bool waitForJob(int jobId);
+    void jobExited(int jobId);
+    void checkUnwatchedJobs();
 };
 
 
@@ -303,12 +369,25 @@ public:
 
 class SmallShell {
 private:
+    struct HashEntry {
+        std::string path;
+        size_t dir_index; // position of its directory in PATH
+        int hits;
+    };
     std::string prompt;
     pid_t pid;
     SmallShell();
     std::string last_pwd;
+    std::unordered_map<std::string, HashEntry> hash_table; // command name -> absolute path
+    std::string hash_path; // the PATH the table was filled from
+    std::vector<std::string> hash_dirs;
+    std::vector<long long> hash_dirs_mtime; // ns, a change drops the table
+    LineArena arena; // words and nodes of the current line
+    void syncHashPath();
+    Command *createSimpleCommand(const CommandNode& node, const std::string& original_cmd_line, bool isAlias);
 public:
     Command *CreateCommand(const char *cmd_line);
+    Command *CreateCommand(const CommandNode& node);
     SmallShell(SmallShell const &) = delete; // disable copy ctor
     void operator=(SmallShell const &) = delete; // disable = operator
     static SmallShell &getInstance() // make SmallShell singleton
@@ -324,6 +403,9 @@ public:
     pid_t getSmashPid();
     void setLastPwd(const std::string& last_pwd);
     std::string getLastPwd();
+    std::string findCommand(const std::string& name, bool count_hit = true);
+    void printHashTable();
+    void clearHashTable();
 };
 
 
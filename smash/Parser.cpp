@@ -0,0 +1,300 @@
+#include <string.h>
+#include <stddef.h>
+#include <new>
+#include <vector>
+#include "Parser.h"
+#include "Commands.h"
+
+#define ARENA_CHUNK_SIZE (4096)
+#define ARENA_ALIGNMENT (alignof(max_align_t))
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////LINE_ARENA///////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+
+LineArena::LineArena() : chunks(nullptr), top(nullptr), end(nullptr) {}
+
+LineArena::~LineArena()
+{
+  while (this->chunks != nullptr)
+  {
+    Chunk* next = this->chunks->next;
+    SMASH_FREE(this->chunks);
+    this->chunks = next;
+  }
+}
+
+void* LineArena::allocate(size_t size)
+{
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  if (this->top == nullptr || (size_t)(this->end - this->top) < size)
+  {
+    size_t chunk_size = sizeof(Chunk) + size > ARENA_CHUNK_SIZE ? sizeof(Chunk) + size : ARENA_CHUNK_SIZE;
+    Chunk* chunk = (Chunk*)SMASH_MALLOC(chunk_size);
+    if (chunk == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    chunk->next = this->chunks;
+    chunk->size = chunk_size;
+    this->chunks = chunk;
+    this->top = (char*)(chunk + 1);
+    this->end = (char*)chunk + chunk_size;
+  }
+  void* allocated = this->top;
+  this->top += size;
+  return allocated;
+}
+
+char* LineArena::copyString(const char* start, size_t length)
+{
+  char* copy = (char*)allocate(length + 1);
+  memcpy(copy, start, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+// keeps the newest chunk for the next line, so a typical line allocates nothing
+void LineArena::reset()
+{
+  if (this->chunks == nullptr)
+  {
+    return;
+  }
+  Chunk* kept = this->chunks;
+  Chunk* chunk = kept->next;
+  while (chunk != nullptr)
+  {
+    Chunk* next = chunk->next;
+    SMASH_FREE(chunk);
+    chunk = next;
+  }
+  kept->next = nullptr;
+  this->top = (char*)(kept + 1);
+  this->end = (char*)kept + kept->size;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////PARSER///////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+
+static bool isSpace(char c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+}
+
+static char* trimmedCopy(LineArena& arena, const char* start, const char* stop)
+{
+  while (start < stop && isSpace(*start))
+  {
+    start++;
+  }
+  while (stop > start && isSpace(stop[-1]))
+  {
+    stop--;
+  }
+  return arena.copyString(start, stop - start);
+}
+
+// the word without the quotes that group it, "a b" becomes a b (like bash)
+static char* unquotedCopy(LineArena& arena, const char* start, const char* stop)
+{
+  char* copy = (char*)arena.allocate(stop - start + 1);
+  char* out = copy;
+  char quote = '\0';
+  for (const char* p = start; p < stop; p++)
+  {
+    if (quote == '\0' && (*p == '\'' || *p == '"'))
+    {
+      quote = *p;
+    }
+    else if (*p == quote)
+    {
+      quote = '\0';
+    }
+    else
+    {
+      *out++ = *p;
+    }
+  }
+  *out = '\0';
+  return copy;
+}
+
+static CommandNode finishStage(LineArena& arena, std::vector<char*>& words, const char* start, const char* stop)
+{
+  CommandNode stage;
+  stage.args = (char**)arena.allocate((words.size() + 1) * sizeof(char*));
+  for (size_t i = 0; i < words.size(); i++)
+  {
+    stage.args[i] = words[i];
+  }
+  stage.args[words.size()] = nullptr;
+  stage.args_num = (int)words.size();
+  stage.bare_text = trimmedCopy(arena, start, stop);
+  stage.text = stage.bare_text;
+  stage.background_word = nullptr;
+  stage.background = false;
+  words.clear();
+  return stage;
+}
+
+const char* parseLine(const char* line, LineArena& arena, LineNode* node, bool operators)
+{
+  // kept between lines so their capacity is reused, only the results go to the arena
+  static std::vector<char*> words;
+  static std::vector<CommandNode> stages;
+  static std::vector<bool> edges;
+  words.clear();
+  stages.clear();
+  edges.clear();
+  const char* start = line;
+  const char* stop = line + strlen(line);
+  while (start < stop && isSpace(*start))
+  {
+    start++;
+  }
+  while (stop > start && isSpace(stop[-1]))
+  {
+    stop--;
+  }
+  node->text = arena.copyString(start, stop - start);
+  node->stages = nullptr;
+  node->stderr_edges = nullptr;
+  node->stages_num = 0;
+  node->redirect_path = nullptr;
+  node->append = false;
+  node->background = false;
+  // a trailing & is the background sign, unless it ends a |&
+  const char* bare_stop = stop;
+  bool glued = false;
+  if (stop > start && stop[-1] == '&')
+  {
+    const char* before = stop - 1;
+    while (before > start && isSpace(before[-1]))
+    {
+      before--;
+    }
+    if (!operators || before == start || before[-1] != '|')
+    {
+      node->background = true;
+      glued = before == stop - 1 && before > start;
+      bare_stop = before;
+    }
+  }
+  const char* stage_start = start;
+  const char* stage_stop = nullptr; // where a redirection cuts the text of the stage
+  bool expect_path = false;
+  const char* p = start;
+  while (true)
+  {
+    while (p < bare_stop && isSpace(*p))
+    {
+      p++;
+    }
+    bool pipe = operators && p < bare_stop && *p == '|';
+    if (p == bare_stop || pipe)
+    {
+      if (expect_path)
+      {
+        return "redirection: missing file";
+      }
+      if (words.empty())
+      {
+        if (!pipe && stages.empty())
+        {
+          return nullptr; // blank line
+        }
+        return "pipe: missing command";
+      }
+      stages.push_back(finishStage(arena, words, stage_start, stage_stop ? stage_stop : p));
+      if (!pipe)
+      {
+        break;
+      }
+      p++;
+      while (p < bare_stop && isSpace(*p))
+      {
+        p++;
+      }
+      bool to_stderr = p < bare_stop && *p == '&';
+      if (to_stderr)
+      {
+        p++;
+      }
+      edges.push_back(to_stderr);
+      stage_start = p;
+      stage_stop = nullptr;
+      continue;
+    }
+    if (operators && *p == '>')
+    {
+      if (expect_path)
+      {
+        return "redirection: missing file";
+      }
+      if (stage_stop == nullptr)
+      {
+        stage_stop = p;
+      }
+      node->append = p + 1 < bare_stop && p[1] == '>';
+      p += node->append ? 2 : 1;
+      expect_path = true;
+      continue;
+    }
+    // a word, quotes keep | > and spaces inside it
+    const char* word = p;
+    while (p < bare_stop && !isSpace(*p) && !(operators && (*p == '|' || *p == '>')))
+    {
+      if (*p == '\'' || *p == '"')
+      {
+        const char* quote = (const char*)memchr(p + 1, *p, bare_stop - p - 1);
+        p = quote ? quote + 1 : bare_stop;
+        continue;
+      }
+      p++;
+    }
+    char* copy = unquotedCopy(arena, word, p);
+    if (expect_path)
+    {
+      node->redirect_path = copy;
+      expect_path = false;
+    }
+    else
+    {
+      words.push_back(copy);
+    }
+  }
+  node->stages_num = (int)stages.size();
+  node->stages = (CommandNode*)arena.allocate(stages.size() * sizeof(CommandNode));
+  node->stderr_edges = (bool*)arena.allocate(edges.size() + 1);
+  for (size_t i = 0; i < stages.size(); i++)
+  {
+    node->stages[i] = stages[i];
+  }
+  for (size_t i = 0; i < edges.size(); i++)
+  {
+    node->stderr_edges[i] = edges[i];
+  }
+  // a simple command owns the whole line, background sign included
+  if (node->stages_num == 1 && node->redirect_path == nullptr)
+  {
+    CommandNode& simple = node->stages[0];
+    simple.text = node->text;
+    simple.background = node->background;
+    if (glued)
+    {
+      const char* last = simple.args[simple.args_num - 1];
+      size_t length = strlen(last);
+      simple.background_word = (char*)arena.allocate(length + 2);
+      memcpy(simple.background_word, last, length);
+      simple.background_word[length] = '&';
+      simple.background_word[length + 1] = '\0';
+    }
+  }
+  return nullptr;
+}
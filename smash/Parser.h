@@ -0,0 +1,66 @@
+#ifndef SMASH_PARSER_H_
+#define SMASH_PARSER_H_
+
+#include <stddef.h>
+
+
+/*################################################################################################
+##############################################LINE_ARENA##########################################
+##################################################################################################*/
+
+
+// Memory of one command line. Words, argument arrays and nodes are carved out of
+// big chunks and all of them are released together when the next line starts.
+class LineArena {
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+    };
+    Chunk* chunks; // newest first
+    char* top;
+    char* end;
+public:
+    LineArena();
+    LineArena(LineArena const &) = delete;
+    void operator=(LineArena const &) = delete;
+    ~LineArena();
+    void* allocate(size_t size);
+    char* copyString(const char* start, size_t length);
+    void reset();
+};
+
+
+/*################################################################################################
+##############################################LINE_NODES##########################################
+##################################################################################################*/
+
+
+// A simple command, the background sign is already taken off its words.
+struct CommandNode {
+    char** args; // NULL terminated
+    int args_num;
+    char* text; // as typed, trimmed
+    char* bare_text; // text without the background sign and the redirection
+    char* background_word; // the last word with the & glued to it ("hi&"), NULL otherwise
+    bool background;
+};
+
+// A whole line: stages joined by | or |&, an optional > or >> target and a trailing &.
+struct LineNode {
+    CommandNode* stages;
+    bool* stderr_edges; // stderr_edges[i] is true when stage i pipes its stderr (|&)
+    int stages_num; // 0 for a blank line
+    char* redirect_path; // NULL without redirection
+    bool append;
+    bool background;
+    char* text; // as typed, trimmed
+};
+
+// Builds the nodes of the line in one pass. Quotes group a word and keep their
+// characters. With operators false | and > are plain word characters, for commands
+// such as watch that take the rest of the line as is.
+// Returns NULL, or the error message for a line that can't be run.
+const char* parseLine(const char* line, LineArena& arena, LineNode* node, bool operators = true);
+
+
+#endif //SMASH_PARSER_H_
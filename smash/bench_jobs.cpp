@@ -0,0 +1,117 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include "Commands.h"
+#include "signals.h"
+
+// The jobs table with 1k to 50k jobs: adding them, looking them up by id and by pid,
+// printing the list and removing them in random order. The pids are made up (above
+// pid_max) so any size fits, and the event loop is started like in smash, so finding
+// the finished jobs only polls it. OLD_SCAN_US is the waitpid pass over the whole table
+// that every call of the old vector-based table made first.
+// Usage: bench_jobs [max_jobs]
+
+#define FAKE_PID_BASE 10000000
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run(int jobs_num)
+{
+    JobsList& jobs = JobsList::getInstance();
+    std::vector<int> order(jobs_num);
+    for (int i = 0; i < jobs_num; i++)
+    {
+        order[i] = i;
+    }
+    std::random_shuffle(order.begin(), order.end());
+
+    uint64_t start = nowNs();
+    for (int i = 0; i < jobs_num; i++)
+    {
+        jobs.addJob("sleep 100 &", FAKE_PID_BASE + i);
+    }
+    double add_ns = (double)(nowNs() - start) / jobs_num;
+
+    int found = 0;
+    start = nowNs();
+    for (int i : order)
+    {
+        found += jobs.getJobById(i + 1) != nullptr ? 1 : 0;
+    }
+    double by_id_ns = (double)(nowNs() - start) / jobs_num;
+
+    start = nowNs();
+    for (int i : order)
+    {
+        found += jobs.isJobExistsByPid(FAKE_PID_BASE + i) ? 1 : 0;
+    }
+    double by_pid_ns = (double)(nowNs() - start) / jobs_num;
+
+    // the listing goes to /dev/null, only its cost is of interest
+    std::cout.flush();
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    start = nowNs();
+    jobs.printJobsList();
+    std::cout.flush();
+    double list_us = (double)(nowNs() - start) / 1000;
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(null_fd);
+
+    start = nowNs();
+    for (int i = 0; i < jobs_num; i++)
+    {
+        waitpid(FAKE_PID_BASE + i, nullptr, WNOHANG);
+    }
+    double old_scan_us = (double)(nowNs() - start) / 1000;
+
+    start = nowNs();
+    for (int i : order)
+    {
+        jobs.removeJobById(i + 1);
+    }
+    double remove_ns = (double)(nowNs() - start) / jobs_num;
+
+    if (found != 2 * jobs_num || jobs.getLastJob() != nullptr)
+    {
+        fprintf(stderr, "bench_jobs: the table lost jobs\n");
+        exit(1);
+    }
+    printf("%8d %10.0f %10.0f %10.0f %10.0f %10.0f %12.0f\n", jobs_num, add_ns, by_id_ns, by_pid_ns, list_us,
+           remove_ns, old_scan_us);
+}
+
+int main(int argc, char* argv[])
+{
+    int max_jobs = argc > 1 ? atoi(argv[1]) : 50000;
+    if (!EventLoop::getInstance().start())
+    {
+        perror("bench_jobs: the event loop failed to start");
+        return 1;
+    }
+    printf("%8s %10s %10s %10s %10s %10s %12s\n", "JOBS", "ADD_NS", "BY_ID_NS", "BY_PID_NS", "LIST_US", "REMOVE_NS",
+           "OLD_SCAN_US");
+    for (int jobs_num = 1000; jobs_num <= max_jobs; jobs_num *= 10)
+    {
+        run(jobs_num);
+        if (jobs_num * 10 > max_jobs && jobs_num < max_jobs)
+        {
+            run(max_jobs);
+        }
+    }
+    return 0;
+}
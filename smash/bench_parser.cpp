@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <regex>
+#include "Parser.h"
+
+// Parse throughput on a generated corpus of command lines: simple commands, long
+// argument lists, pipelines of 2 to 6 stages, |&, redirections, quotes and background
+// signs. "parser" is parseLine into the per-line arena, reset between lines like
+// smash does. "baseline" redoes the per-line work of the old code: trim, three
+// istringstream tokenizations with a malloc per word, and the std::regex objects
+// CreateCommand built on every call. The baseline is slow enough that it only runs
+// over the first BASELINE_LINES lines.
+// Usage: bench_parser [lines] [seed]
+
+#define BASELINE_LINES 10000
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const char* WORDS[] = {"ls", "-l", "grep", "error", "wc", "-c", "cat", "log.txt", "sort", "-n", "uniq",
+                              "head", "-20", "cut", "-d:", "-f2", "echo", "hello", "world", "/usr/bin/find",
+                              "sleep", "10", "tr", "a-z", "A-Z", "jobs", "kill", "-9", "3", "chprompt"};
+#define WORDS_NUM (sizeof(WORDS) / sizeof(WORDS[0]))
+
+static std::string randomCommand(int max_args)
+{
+    std::string command = WORDS[rand() % WORDS_NUM];
+    int args_num = rand() % (max_args + 1);
+    for (int i = 0; i < args_num; i++)
+    {
+        command += " ";
+        if (rand() % 10 == 0)
+        {
+            command += "\"quoted | text > here\"";
+            continue;
+        }
+        command += WORDS[rand() % WORDS_NUM];
+    }
+    return command;
+}
+
+static std::string randomLine()
+{
+    int kind = rand() % 6;
+    std::string line;
+    if (kind == 0)
+    {
+        line = randomCommand(40); // past the old 20 argument limit
+    }
+    else if (kind <= 2)
+    {
+        int stages = 2 + rand() % 5;
+        line = randomCommand(4);
+        for (int i = 1; i < stages; i++)
+        {
+            line += rand() % 4 == 0 ? " |& " : " | ";
+            line += randomCommand(4);
+        }
+    }
+    else if (kind == 3)
+    {
+        line = randomCommand(6) + (rand() % 2 ? " > out.txt" : " >> out.txt");
+    }
+    else
+    {
+        line = randomCommand(6);
+    }
+    if (rand() % 5 == 0)
+    {
+        line += rand() % 2 ? " &" : "&";
+    }
+    return "  " + line + " ";
+}
+
+static std::string trim(const std::string& s)
+{
+    const char* whitespace = " \n\r\t\f\v";
+    size_t start = s.find_first_not_of(whitespace);
+    if (start == std::string::npos)
+    {
+        return "";
+    }
+    return s.substr(start, s.find_last_not_of(whitespace) + 1 - start);
+}
+
+// what the old code did for every line before running anything
+static size_t baselineParse(const char* line)
+{
+    std::string trimmed = trim(std::string(line));
+    size_t words = 0;
+    for (int pass = 0; pass < 3; pass++) // Command, BuiltInCommand and the child
+    {
+        std::vector<char*> args;
+        std::istringstream iss(trimmed);
+        for (std::string word; iss >> word;)
+        {
+            char* copy = (char*)malloc(word.length() + 1);
+            strcpy(copy, word.c_str());
+            args.push_back(copy);
+        }
+        words += args.size();
+        for (char* arg : args)
+        {
+            free(arg);
+        }
+    }
+    std::regex alias_pattern("^alias [a-zA-Z0-9_]+='[^']*'$");
+    bool alias = std::regex_match(trimmed, alias_pattern);
+    if (!alias && trimmed.find('|') != std::string::npos)
+    {
+        std::regex pipe_pattern(R"(\|\s*&|\|&)");
+        words += std::regex_search(trimmed, pipe_pattern) ? 1 : 0;
+    }
+    if (!alias && trimmed.find('>') != std::string::npos)
+    {
+        std::regex append_pattern(R"(\S+\s*>>\s*\S+)");
+        words += std::regex_search(trimmed, append_pattern) ? 1 : 0;
+    }
+    return words;
+}
+
+static size_t parserParse(const char* line, LineArena& arena)
+{
+    arena.reset();
+    LineNode node;
+    if (parseLine(line, arena, &node) != nullptr)
+    {
+        return 0;
+    }
+    size_t words = 0;
+    for (int i = 0; i < node.stages_num; i++)
+    {
+        words += node.stages[i].args_num;
+    }
+    return words;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t lines_num = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+    std::vector<std::string> corpus;
+    for (size_t i = 0; i < lines_num; i++)
+    {
+        corpus.push_back(randomLine());
+    }
+    printf("%-9s %10s %10s %12s %10s %10s\n", "PARSER", "LINES", "MB", "LINES/S", "MB/S", "NS/LINE");
+    LineArena arena;
+    for (int round = 0; round < 2; round++)
+    {
+        for (int baseline = 0; baseline <= 1; baseline++)
+        {
+            size_t measured = baseline && lines_num > BASELINE_LINES ? BASELINE_LINES : lines_num;
+            size_t bytes = 0;
+            size_t words = 0;
+            uint64_t start = nowNs();
+            for (size_t i = 0; i < measured; i++)
+            {
+                const char* line = corpus[i].c_str();
+                words += baseline ? baselineParse(line) : parserParse(line, arena);
+                bytes += corpus[i].size();
+            }
+            double seconds = (nowNs() - start) / 1e9;
+            printf("%-9s %10zu %10.1f %12.0f %10.1f %10.1f\n", baseline ? "baseline" : "parser", measured,
+                   bytes / 1e6, measured / seconds, bytes / 1e6 / seconds, seconds * 1e9 / measured);
+            if (words == 0)
+            {
+                fprintf(stderr, "bench_parser: nothing parsed\n");
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include "Commands.h"
+#include "signals.h"
+
+// Log processing pipelines of 4, 6 and 8 stages over a generated log file. Each one
+// runs once as a smash pipeline, where the stages run concurrently and talk through
+// pipes, and once stage after stage through temporary files. CPU_S is the CPU time
+// of the children. On a single CPU the concurrent stages can't overlap, what is left
+// is the temporary file traffic.
+// Usage: bench_pipeline [log_mb] [tmp_dir]
+
+#define PIPELINES_NUM 3
+
+static const char* PIPELINES[PIPELINES_NUM] = {
+    "cat LOG | grep ERROR | cut -d: -f2 | wc -l",
+    "cat LOG | grep -v DEBUG | cut -d: -f2,3 | tr a-z A-Z | sort | wc -l",
+    "cat LOG | grep -v DEBUG | cut -d: -f3- | tr a-z A-Z | sed s/TOOK/T/ | sort | uniq -c | wc -l",
+};
+
+static const char* LEVELS[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double childrenCpu()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void generateLog(const std::string& path, size_t size)
+{
+    FILE* log = fopen(path.c_str(), "w");
+    if (log == NULL)
+    {
+        perror("bench_pipeline: can't create the log");
+        exit(1);
+    }
+    srand(1);
+    for (size_t written = 0; written < size;)
+    {
+        int length = fprintf(log, "%d %s:user%d:service%d:request took %d ms\n", 1700000000 + rand() % 86400,
+                             LEVELS[rand() % 4], rand() % 500, rand() % 20, rand() % 1000);
+        written += length;
+    }
+    fclose(log);
+}
+
+static std::string replaceLog(std::string pipeline, const std::string& log)
+{
+    return pipeline.replace(pipeline.find("LOG"), 3, log);
+}
+
+static std::string readResult(const std::string& path)
+{
+    FILE* result = fopen(path.c_str(), "r");
+    char line[64] = "";
+    if (result == NULL || fgets(line, sizeof(line), result) == NULL)
+    {
+        line[0] = '\0';
+    }
+    if (result != NULL)
+    {
+        fclose(result);
+    }
+    return std::string(line, strcspn(line, "\n"));
+}
+
+// the pipeline run by smash, its stdout sent to result
+static void runInSmash(const std::string& pipeline, const std::string& result)
+{
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int fd = open(result.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    SmallShell::getInstance().executeCommand(pipeline.c_str());
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+// one stage at a time, each reading the file the previous one wrote
+static void runThroughFiles(const std::string& pipeline, const std::string& tmp_dir, const std::string& result)
+{
+    std::vector<std::string> stages;
+    for (size_t start = 0, end; start <= pipeline.size(); start = end + 1)
+    {
+        end = pipeline.find('|', start);
+        end = end == std::string::npos ? pipeline.size() : end;
+        stages.push_back(pipeline.substr(start, end - start));
+    }
+    std::string input = "/dev/null";
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        std::string output = i + 1 == stages.size() ? result : tmp_dir + "/bench_pipeline." + std::to_string(i);
+        std::vector<std::string> words;
+        std::istringstream iss(stages[i]);
+        for (std::string word; iss >> word;)
+        {
+            words.push_back(word);
+        }
+        std::vector<char*> args;
+        for (std::string& word : words)
+        {
+            args.push_back(&word[0]);
+        }
+        args.push_back(NULL);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int in = open(input.c_str(), O_RDONLY);
+            int out = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (in == -1 || out == -1 || dup2(in, STDIN_FILENO) == -1 || dup2(out, STDOUT_FILENO) == -1)
+            {
+                _exit(1);
+            }
+            execvp(args[0], args.data());
+            _exit(1);
+        }
+        waitpid(pid, NULL, 0);
+        if (i > 0)
+        {
+            unlink(input.c_str());
+        }
+        input = output;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t log_size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) * 1024 * 1024;
+    std::string tmp_dir = argc > 2 ? argv[2] : "/tmp";
+    std::string log = tmp_dir + "/bench_pipeline.log";
+    std::string result = tmp_dir + "/bench_pipeline.result";
+    generateLog(log, log_size);
+    if (!EventLoop::getInstance().start())
+    {
+        perror("bench_pipeline: the event loop failed to start");
+        return 1;
+    }
+    printf("%-7s %-10s %10s %10s %12s\n", "STAGES", "RUN", "WALL_S", "CPU_S", "RESULT");
+    for (int i = 0; i < PIPELINES_NUM; i++)
+    {
+        std::string pipeline = replaceLog(PIPELINES[i], log);
+        int stages = 1;
+        for (char c : pipeline)
+        {
+            stages += c == '|' ? 1 : 0;
+        }
+        for (int through_files = 0; through_files <= 1; through_files++)
+        {
+            double cpu = childrenCpu();
+            uint64_t start = nowNs();
+            if (through_files)
+            {
+                runThroughFiles(pipeline, tmp_dir, result);
+            }
+            else
+            {
+                runInSmash(pipeline, result);
+            }
+            double wall = (nowNs() - start) / 1e9;
+            printf("%-7d %-10s %10.2f %10.2f %12s\n", stages, through_files ? "tmp-files" : "smash", wall,
+                   childrenCpu() - cpu, readResult(result).c_str());
+        }
+    }
+    unlink(log.c_str());
+    unlink(result.c_str());
+    return 0;
+}
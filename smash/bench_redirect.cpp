@@ -0,0 +1,88 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "Commands.h"
+#include "signals.h"
+
+// Runs "/bin/true > /dev/null" many times through smash, which spawns the command with
+// its stdout already redirected, and the same command the way smash ran it before: a
+// forked copy of smash redirects its stdout, forks again, execs and waits. ballast_mb
+// of touched memory makes both forks copy the page tables of a bigger shell.
+// Usage: bench_redirect [commands] [ballast_mb]
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void doubleFork(const char* path, const char* file)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0655);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1)
+        {
+            _exit(1);
+        }
+        close(fd);
+        pid_t command = fork();
+        if (command == 0)
+        {
+            execl(path, path, (char*)NULL);
+            _exit(1);
+        }
+        waitpid(command, NULL, 0);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char* argv[])
+{
+    int commands = argc > 1 ? atoi(argv[1]) : 10000;
+    size_t ballast_size = (argc > 2 ? strtoul(argv[2], NULL, 10) : 0) * 1024 * 1024;
+    char* ballast = ballast_size > 0 ? (char*)malloc(ballast_size) : NULL;
+    if (ballast != NULL)
+    {
+        memset(ballast, 'b', ballast_size);
+        // the ballast is never read, keep the compiler from dropping it
+        __asm__ volatile("" : : "r"(ballast) : "memory");
+    }
+    if (!EventLoop::getInstance().start())
+    {
+        perror("bench_redirect: the event loop failed to start");
+        return 1;
+    }
+    SmallShell& smash = SmallShell::getInstance();
+    smash.executeCommand("/bin/true > /dev/null");
+
+    uint64_t start = nowNs();
+    for (int i = 0; i < commands; i++)
+    {
+        smash.executeCommand("/bin/true > /dev/null");
+    }
+    double smash_s = (nowNs() - start) / 1e9;
+
+    start = nowNs();
+    for (int i = 0; i < commands; i++)
+    {
+        doubleFork("/bin/true", "/dev/null");
+    }
+    double double_fork_s = (nowNs() - start) / 1e9;
+
+    printf("%-12s %10s %10s %12s %12s\n", "LAUNCH", "COMMANDS", "SECONDS", "US/COMMAND", "COMMANDS/S");
+    printf("%-12s %10d %10.2f %12.1f %12.0f\n", "smash", commands, smash_s, smash_s * 1e6 / commands,
+           commands / smash_s);
+    printf("%-12s %10d %10.2f %12.1f %12.0f\n", "double-fork", commands, double_fork_s,
+           double_fork_s * 1e6 / commands, commands / double_fork_s);
+    free(ballast);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include "Commands.h"
+#include "signals.h"
+
+// Streams 1 GB of stderr through "producer |& wc -c" in smash, with the default pipe
+// buffers and with SMASH_PIPE_SIZE=1048576. The producer is this program run again
+// with --produce, writing 64 KB at a time to stderr. The count wc prints is checked.
+// Usage: bench_stderr_pipe [mb] [result_file]
+
+#define CHUNK_SIZE (64 * 1024)
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int produce(size_t size)
+{
+    static char chunk[CHUNK_SIZE];
+    memset(chunk, 'e', CHUNK_SIZE);
+    for (size_t done = 0; done < size;)
+    {
+        size_t length = size - done < CHUNK_SIZE ? size - done : CHUNK_SIZE;
+        ssize_t written = write(STDERR_FILENO, chunk, length);
+        if (written <= 0)
+        {
+            return 1;
+        }
+        done += written;
+    }
+    return 0;
+}
+
+// seconds to stream size bytes, or -1 when wc counted something else
+static double run(const std::string& self, size_t size, const char* pipe_size, const std::string& result)
+{
+    if (pipe_size != NULL)
+    {
+        setenv("SMASH_PIPE_SIZE", pipe_size, 1);
+    }
+    else
+    {
+        unsetenv("SMASH_PIPE_SIZE");
+    }
+    std::string line = self + " --produce " + std::to_string(size) + " |& wc -c";
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int fd = open(result.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    uint64_t start = nowNs();
+    SmallShell::getInstance().executeCommand(line.c_str());
+    double seconds = (nowNs() - start) / 1e9;
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    FILE* counted = fopen(result.c_str(), "r");
+    unsigned long long bytes = 0;
+    if (counted == NULL || fscanf(counted, "%llu", &bytes) != 1)
+    {
+        bytes = 0;
+    }
+    if (counted != NULL)
+    {
+        fclose(counted);
+    }
+    return bytes == size ? seconds : -1;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "--produce") == 0)
+    {
+        return produce(strtoull(argv[2], NULL, 10));
+    }
+    size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1024) * 1024 * 1024;
+    std::string result = argc > 2 ? argv[2] : "/tmp/bench_stderr_pipe.result";
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length == -1)
+    {
+        perror("bench_stderr_pipe: readlink failed");
+        return 1;
+    }
+    self[length] = '\0';
+    if (!EventLoop::getInstance().start())
+    {
+        perror("bench_stderr_pipe: the event loop failed to start");
+        return 1;
+    }
+    const char* pipe_sizes[] = {NULL, "1048576"};
+    printf("%-10s %8s %10s %10s\n", "PIPE_SIZE", "MB", "SECONDS", "MB/S");
+    for (const char* pipe_size : pipe_sizes)
+    {
+        double seconds = run(self, size, pipe_size, result);
+        if (seconds < 0)
+        {
+            fprintf(stderr, "bench_stderr_pipe: wc counted the wrong number of bytes\n");
+            return 1;
+        }
+        printf("%-10s %8zu %10.2f %10.1f\n", pipe_size ? pipe_size : "default", size / (1024 * 1024), seconds,
+               size / (1024.0 * 1024) / seconds);
+    }
+    unlink(result.c_str());
+    return 0;
+}
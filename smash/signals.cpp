@@ -3,6 +3,12 @@
 #include "signals.h"
 #include "Commands.h"
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
 
 using namespace std;
 
@@ -10,13 +16,15 @@ void ctrlCHandler(int sig_num) {
   cout << "smash: got ctrl-C" << endl;
   JobsList::JobEntry* job_entry = JobsList::getInstance().getJobInForeground();
   pid_t pid = -1;
+  pid_t target = -1;
   if (job_entry != nullptr)
   {
     pid = job_entry->getPid();
+    target = job_entry->getSignalTarget();
   }
   if(pid != -1)
   {
-    if (kill(pid,SIGKILL) == -1)
+    if (kill(target,SIGKILL) == -1)
     {
       perror("smash error: kill failed");
       return;
@@ -24,3 +32,277 @@ void ctrlCHandler(int sig_num) {
     cout << "smash: process "<< pid <<" was killed" << endl;
   }
 }
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////EVENT_LOOP///////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#define EVENTS_PER_WAIT (64)
+
+// what an epoll event is about, in the high half of its data, the job id or pid in the low half
+enum EventType { EVENT_INPUT, EVENT_SIGNAL, EVENT_JOB, EVENT_PROCESS };
+
+static uint64_t eventData(EventType type, int value)
+{
+  return ((uint64_t)type << 32) | (uint32_t)value;
+}
+
+static int pidfdOpen(pid_t pid)
+{
+  return syscall(SYS_pidfd_open, pid, 0);
+}
+
+EventLoop::EventLoop() : epoll_fd(-1), signal_fd(-1), owner(-1), stdin_polled(false), input_ready(false),
+                         dispatching(false), waited_pid(-1), waited_exited(false)
+{
+  sigprocmask(SIG_BLOCK, nullptr, &this->child_mask);
+}
+
+// SIGINT, SIGCHLD and SIGTSTP are blocked and read from the signalfd from now on.
+// Returns false, with the old handling left in place, when the kernel lacks a piece.
+bool EventLoop::start()
+{
+  sigset_t handled;
+  sigemptyset(&handled);
+  sigaddset(&handled, SIGINT);
+  sigaddset(&handled, SIGCHLD);
+  sigaddset(&handled, SIGTSTP);
+  if (sigprocmask(SIG_BLOCK, &handled, &this->child_mask) == -1)
+  {
+    return false;
+  }
+  this->signal_fd = signalfd(-1, &handled, SFD_NONBLOCK | SFD_CLOEXEC);
+  this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = eventData(EVENT_SIGNAL, 0);
+  if (this->signal_fd == -1 || this->epoll_fd == -1 ||
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->signal_fd, &event) == -1)
+  {
+    int error = errno;
+    close(this->signal_fd);
+    close(this->epoll_fd);
+    this->signal_fd = -1;
+    this->epoll_fd = -1;
+    sigprocmask(SIG_SETMASK, &this->child_mask, nullptr);
+    errno = error;
+    return false;
+  }
+  // one shot, re-armed by readLine, so typed-ahead input doesn't wake a foreground wait
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.u64 = eventData(EVENT_INPUT, 0);
+  this->stdin_polled = epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, 0, &event) == 0; // EPERM for a file
+  this->owner = getpid();
+  return true;
+}
+
+bool EventLoop::isActive()
+{
+  return this->epoll_fd != -1 && getpid() == this->owner;
+}
+
+void EventLoop::dispatch(int timeout)
+{
+  if (this->dispatching)
+  {
+    return; // a handler asked for pending events, they are being handled
+  }
+  this->dispatching = true;
+  struct epoll_event events[EVENTS_PER_WAIT];
+  int events_num = epoll_wait(this->epoll_fd, events, EVENTS_PER_WAIT, timeout);
+  if (events_num == -1 && errno != EINTR)
+  {
+    perror("smash error: epoll_wait failed");
+  }
+  for (int i = 0; i < events_num; i++)
+  {
+    int value = (int)(uint32_t)events[i].data.u64;
+    switch (events[i].data.u64 >> 32)
+    {
+      case EVENT_INPUT:
+        this->input_ready = true;
+        break;
+      case EVENT_SIGNAL:
+        handleSignals();
+        break;
+      case EVENT_JOB:
+        JobsList::getInstance().jobExited(value);
+        break;
+      case EVENT_PROCESS:
+        this->waited_exited = this->waited_exited || value == this->waited_pid;
+        break;
+    }
+  }
+  this->dispatching = false;
+}
+
+void EventLoop::handleSignals()
+{
+  struct signalfd_siginfo info;
+  bool child_exited = false;
+  while (read(this->signal_fd, &info, sizeof(info)) == sizeof(info))
+  {
+    if (info.ssi_signo == SIGINT)
+    {
+      ctrlCHandler(SIGINT);
+    }
+    else if (info.ssi_signo == SIGCHLD)
+    {
+      child_exited = true;
+    }
+    // SIGTSTP is taken and dropped, smash itself is never stopped
+  }
+  if (child_exited)
+  {
+    JobsList::getInstance().checkUnwatchedJobs();
+  }
+}
+
+// the next line of stdin, without its '\n'; false at the end of the input
+bool EventLoop::readLine(std::string& line)
+{
+  if (!isActive())
+  {
+    return (bool)std::getline(std::cin, line);
+  }
+  while (true)
+  {
+    size_t end = this->input.find('\n');
+    if (end != std::string::npos)
+    {
+      line = this->input.substr(0, end);
+      this->input.erase(0, end + 1);
+      return true;
+    }
+    if (this->stdin_polled && !this->input_ready)
+    {
+      struct epoll_event event;
+      event.events = EPOLLIN | EPOLLONESHOT;
+      event.data.u64 = eventData(EVENT_INPUT, 0);
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, 0, &event);
+      while (!this->input_ready)
+      {
+        dispatch(-1);
+      }
+    }
+    this->input_ready = false;
+    char buffer[SMASH_BUFFER_SIZE];
+    ssize_t bytes_num = read(0, buffer, sizeof(buffer));
+    if (bytes_num == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (bytes_num <= 0)
+    {
+      if (bytes_num == -1)
+      {
+        perror("smash error: read failed");
+      }
+      if (this->input.empty())
+      {
+        return false;
+      }
+      line = this->input;
+      this->input.clear();
+      return true;
+    }
+    this->input.append(buffer, bytes_num);
+  }
+}
+
+// handles what is pending without blocking
+void EventLoop::poll()
+{
+  if (isActive())
+  {
+    dispatch(0);
+  }
+}
+
+// runs the loop until the job left the list, ctrl-C and other jobs are served meanwhile
+void EventLoop::waitForJob(int job_id)
+{
+  while (JobsList::getInstance().findJob(job_id) != nullptr)
+  {
+    dispatch(-1);
+  }
+}
+
+// for children that aren't jobs, reaps the child
+bool EventLoop::waitForProcess(pid_t pid)
+{
+  int pidfd = isActive() ? pidfdOpen(pid) : -1;
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = eventData(EVENT_PROCESS, pid);
+  if (pidfd != -1 && epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, pidfd, &event) == 0)
+  {
+    this->waited_pid = pid;
+    this->waited_exited = false;
+    while (!this->waited_exited)
+    {
+      dispatch(-1);
+    }
+    this->waited_pid = -1;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, pidfd, nullptr);
+  }
+  if (pidfd != -1)
+  {
+    close(pidfd);
+  }
+  return waitpid(pid, nullptr, 0) != -1;
+}
+
+// Returns the pidfd that reports the exit of the job, or -1 when the job is left to
+// the SIGCHLD scan (no pidfd support, or a forked copy of smash).
+int EventLoop::watchJob(pid_t pid, int job_id)
+{
+  if (!isActive())
+  {
+    return -1;
+  }
+  int pidfd = pidfdOpen(pid);
+  if (pidfd == -1)
+  {
+    return -1;
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = eventData(EVENT_JOB, job_id);
+  if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, pidfd, &event) == -1)
+  {
+    close(pidfd);
+    return -1;
+  }
+  return pidfd;
+}
+
+void EventLoop::unwatchJob(int pidfd)
+{
+  if (pidfd == -1)
+  {
+    return;
+  }
+  // a forked copy shares the epoll instance, only the owner may change it
+  if (isActive())
+  {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, pidfd, nullptr);
+  }
+  close(pidfd);
+}
+
+// called first thing in a forked child, which gets its signals back
+void EventLoop::forkedChild()
+{
+  if (this->epoll_fd != -1)
+  {
+    sigprocmask(SIG_SETMASK, &this->child_mask, nullptr);
+  }
+}
+
+const sigset_t* EventLoop::childMask()
+{
+  return &this->child_mask;
+}
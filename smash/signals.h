@@ -1,6 +1,56 @@
 #ifndef SMASH__SIGNALS_H_
 #define SMASH__SIGNALS_H_
 
+#include <signal.h>
+#include <sys/types.h>
+#include <string>
+
 void ctrlCHandler(int sig_num);
 
+
+/*################################################################################################
+##############################################EVENT_LOOP##########################################
+##################################################################################################*/
+
+
+// One epoll instance for everything smash waits on: lines on stdin, SIGINT, SIGCHLD
+// and SIGTSTP through a signalfd, and the exit of every job through its pidfd.
+// Handlers run from the loop, never inside a signal handler. Forked copies of smash
+// (watch, built-in pipeline stages) don't own the loop and fall back to blocking waits.
+class EventLoop {
+    int epoll_fd;
+    int signal_fd;
+    pid_t owner; // the process the loop belongs to
+    sigset_t child_mask; // the mask smash started with, restored for its children
+    bool stdin_polled; // false when epoll can't watch stdin (a regular file)
+    bool input_ready;
+    bool dispatching;
+    std::string input; // read from stdin, not returned as lines yet
+    pid_t waited_pid; // a child waited for outside the jobs list
+    bool waited_exited;
+    EventLoop();
+    void dispatch(int timeout);
+    void handleSignals();
+public:
+    EventLoop(EventLoop const &) = delete;
+    void operator=(EventLoop const &) = delete;
+    static EventLoop &getInstance()
+    {
+        static EventLoop instance; // Guaranteed to be destroyed.
+        // Instantiated on first use.
+        return instance;
+    }
+    bool start();
+    bool isActive();
+    bool readLine(std::string& line);
+    void poll();
+    void waitForJob(int job_id);
+    bool waitForProcess(pid_t pid);
+    int watchJob(pid_t pid, int job_id);
+    void unwatchJob(int pidfd);
+    void forkedChild();
+    const sigset_t* childMask();
+};
+
+
 #endif //SMASH__SIGNALS_H_
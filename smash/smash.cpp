@@ -6,17 +6,22 @@
 #include "signals.h"
 
 int main(int argc, char *argv[]) {
-    if (signal(SIGINT, ctrlCHandler) == SIG_ERR) {
-        perror("smash error: failed to set ctrl-C handler");
+    EventLoop &events = EventLoop::getInstance();
+    if (!events.start()) {
+        perror("smash error: failed to start the event loop");
+        if (signal(SIGINT, ctrlCHandler) == SIG_ERR) {
+            perror("smash error: failed to set ctrl-C handler");
+        }
     }
 
-
     SmallShell &smash = SmallShell::getInstance();
     while (true) {
-        std::cout << smash.getPrompt();
+        std::cout << smash.getPrompt() << std::flush;
         std::string cmd_line;
-        std::getline(std::cin, cmd_line);
+        if (!events.readLine(cmd_line)) {
+            break;
+        }
         smash.executeCommand(cmd_line.c_str());
     }
     return 0;
-}
\ No newline at end of file
+}